@@ -0,0 +1,247 @@
+//
+// In-process tracing agent, preloaded into the tracee with LD_PRELOAD.
+//
+// The debugger replaces the instructions at a tracepoint with a 5-byte jmp to
+// a jump pad it builds in the area this agent reserves. The pad calls
+// minidbg_agent_trampoline, which saves the complete register state, records
+// the registers and the captured memory into the shared ring and returns to
+// the pad, which executes the relocated original instructions and jumps back.
+// A hit never stops the tracee.
+//
+
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cpuid.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include "../include/trace_ring.h"
+
+// hidden, so the trampoline can reach them RIP-relative without the GOT
+extern "C" {
+    __attribute__((visibility("hidden"))) void minidbg_agent_trampoline();
+    __attribute__((visibility("hidden"))) void minidbg_agent_hit(uint64_t id, const uint64_t *saved);
+    // size of the XSAVE area for the features enabled in XCR0
+    __attribute__((visibility("hidden"))) uint64_t minidbg_agent_xsave_size = 0;
+}
+
+namespace {
+    trace_ring::header *g_ring = nullptr;
+
+    __thread uint32_t t_tid __attribute__((tls_model("initial-exec"))) = 0;
+
+    // the trampoline pushes rflags and then rax..r15, so the saved registers
+    // are r15 first at the lowest address, followed by the return address
+    // into the pad and the tracepoint id which the pad pushed
+    enum saved_slot {
+        s_r15, s_r14, s_r13, s_r12, s_r11, s_r10, s_r9, s_r8,
+        s_rbp, s_rdi, s_rsi, s_rdx, s_rcx, s_rbx, s_rax, s_rflags,
+        s_return, s_id, n_saved,
+    };
+    // the pad moves rsp below the red zone before calling the trampoline
+    constexpr uint64_t red_zone = 128;
+
+    // jmp rel32 can reach +-2GB, look for free space below and above the
+    // main executable
+    void *map_near_executable(std::size_t size) {
+        auto base = getauxval(AT_PHDR) & ~uint64_t{0xfffff};
+        constexpr uint64_t step = 1u << 20;
+        for (uint64_t i = 1; i < 1024; ++i) {
+            for (auto hint: {base - i * step, base + (64 + i) * step}) {
+                if (hint < step || hint > base + (uint64_t{1} << 30) || hint + (uint64_t{1} << 30) < base) {
+                    continue;
+                }
+                auto *p = mmap(reinterpret_cast<void *>(hint), size, PROT_READ | PROT_EXEC,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+                if (p == reinterpret_cast<void *>(hint)) {
+                    return p;
+                }
+                if (p != MAP_FAILED) {
+                    munmap(p, size);
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    uint64_t load(uint64_t address, const trace_ring::capture &c) {
+        uint64_t value = 0;
+        auto *src = reinterpret_cast<const volatile uint8_t *>(address);
+        // byte by byte so the compiler does not call memcpy, which could
+        // itself be traced
+        for (uint32_t i = 0; i < c.size && i < sizeof(value); ++i) {
+            value |= static_cast<uint64_t>(src[i]) << (8 * i);
+        }
+        if (c.is_signed && c.size < sizeof(value)) {
+            auto shift = 64 - 8 * c.size;
+            value = static_cast<uint64_t>(static_cast<int64_t>(value << shift) >> shift);
+        }
+        return value;
+    }
+
+    __attribute__((constructor)) void minidbg_agent_init() {
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid_count(0xd, 0, &eax, &ebx, &ecx, &edx) || ebx == 0) {
+            return;
+        }
+        minidbg_agent_xsave_size = ebx;
+
+        auto name = trace_ring::shm_name(getpid());
+        auto fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+        if (fd < 0) {
+            return;
+        }
+        if (ftruncate(fd, sizeof(trace_ring::header)) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            return;
+        }
+        auto *p = mmap(nullptr, sizeof(trace_ring::header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            return;
+        }
+
+        // the pads are only readable and executable for the tracee, the
+        // debugger writes them through /proc/<pid>/mem or ptrace
+        auto *pads = map_near_executable(trace_ring::pad_area_size);
+        if (!pads) {
+            munmap(p, sizeof(trace_ring::header));
+            shm_unlink(name.c_str());
+            return;
+        }
+
+        auto *ring = static_cast<trace_ring::header *>(p);
+        ring->version = trace_ring::version;
+        ring->trampoline = reinterpret_cast<uint64_t>(&minidbg_agent_trampoline);
+        ring->pad_area = reinterpret_cast<uint64_t>(pads);
+        ring->pad_area_size = trace_ring::pad_area_size;
+        std::atomic_thread_fence(std::memory_order_release);
+        ring->magic = trace_ring::magic;
+        g_ring = ring;
+    }
+
+    // the debugger unlinks the ring once it attached, a tracee which never
+    // had a tracepoint must not leave it behind
+    __attribute__((destructor)) void minidbg_agent_fini() {
+        if (g_ring) {
+            shm_unlink(trace_ring::shm_name(getpid()).c_str());
+        }
+    }
+}
+
+extern "C" void minidbg_agent_hit(uint64_t id, const uint64_t *saved) {
+    auto *ring = g_ring;
+    if (!ring || id >= trace_ring::max_tracepoints) {
+        return;
+    }
+
+    auto head = ring->head.load(std::memory_order_relaxed);
+    do {
+        if (head - ring->tail.load(std::memory_order_acquire) >= trace_ring::n_records) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    } while (!ring->head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed));
+
+    if (!t_tid) {
+        t_tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    }
+
+    const auto &tp = ring->tracepoints[id];
+    auto &r = ring->records[head % trace_ring::n_records];
+    r.tracepoint = static_cast<uint32_t>(id);
+    r.tid = t_tid;
+
+    // enum class reg order
+    const saved_slot order[] = {s_rax, s_rbx, s_rcx, s_rdx, s_rdi, s_rsi, s_rbp};
+    for (std::size_t i = 0; i < 7; ++i) {
+        r.regs[i] = saved[order[i]];
+    }
+    r.regs[7] = reinterpret_cast<uint64_t>(saved + n_saved) + red_zone; // rsp
+    for (std::size_t i = 0; i < 8; ++i) {
+        r.regs[8 + i] = saved[s_r8 - i];
+    }
+    r.regs[16] = tp.addr; // rip
+    r.regs[17] = saved[s_rflags];
+
+    for (uint32_t i = 0; i < tp.n_captures && i < trace_ring::max_captures; ++i) {
+        const auto &c = tp.captures[i];
+        auto base = c.base_reg >= 0 ? r.regs[c.base_reg] : 0;
+        r.values[i] = load(base + c.offset, c);
+    }
+
+    r.seq.store(head + 1, std::memory_order_release);
+}
+
+// Saves every register the C handler could clobber, including the extended
+// state through XSAVE with all XCR0 components, since the traced code may be
+// in the middle of using vector registers. DF is cleared as the ABI requires.
+asm(R"(
+        .text
+        .globl minidbg_agent_trampoline
+        .hidden minidbg_agent_trampoline
+        .type minidbg_agent_trampoline, @function
+        .intel_syntax noprefix
+minidbg_agent_trampoline:
+        pushfq
+        push rax
+        push rbx
+        push rcx
+        push rdx
+        push rsi
+        push rdi
+        push rbp
+        push r8
+        push r9
+        push r10
+        push r11
+        push r12
+        push r13
+        push r14
+        push r15
+        cld
+        mov rbp, rsp
+        sub rsp, qword ptr [rip + minidbg_agent_xsave_size]
+        and rsp, -64
+        xor eax, eax
+        mov qword ptr [rsp + 512], rax
+        mov qword ptr [rsp + 520], rax
+        mov qword ptr [rsp + 528], rax
+        mov qword ptr [rsp + 536], rax
+        mov qword ptr [rsp + 544], rax
+        mov qword ptr [rsp + 552], rax
+        mov qword ptr [rsp + 560], rax
+        mov qword ptr [rsp + 568], rax
+        mov eax, -1
+        mov edx, -1
+        xsave64 [rsp]
+        mov rdi, qword ptr [rbp + 136]
+        mov rsi, rbp
+        call minidbg_agent_hit
+        mov eax, -1
+        mov edx, -1
+        xrstor64 [rsp]
+        mov rsp, rbp
+        pop r15
+        pop r14
+        pop r13
+        pop r12
+        pop r11
+        pop r10
+        pop r9
+        pop r8
+        pop rbp
+        pop rdi
+        pop rsi
+        pop rdx
+        pop rcx
+        pop rbx
+        pop rax
+        popfq
+        ret
+        .size minidbg_agent_trampoline, . - minidbg_agent_trampoline
+        .att_syntax prefix
+)");
@@ -169,4 +169,92 @@ abbrev_entry::read(cursor *cur)
         return true;
 }
 
+/**
+ * Return the size of an attribute with the given form, or -1 if the
+ * size depends on its data.  This must agree with cursor::skip_form.
+ */
+static int
+fixed_form_size(DW_FORM form, unsigned addr_size, format fmt)
+{
+        // Section 7.5.4
+        switch (form) {
+        case DW_FORM::addr:
+                return addr_size;
+        case DW_FORM::sec_offset:
+        case DW_FORM::ref_addr:
+        case DW_FORM::strp:
+                return fmt == format::dwarf64 ? 8 : 4;
+        case DW_FORM::flag_present:
+                return 0;
+        case DW_FORM::flag:
+        case DW_FORM::data1:
+        case DW_FORM::ref1:
+                return 1;
+        case DW_FORM::data2:
+        case DW_FORM::ref2:
+                return 2;
+        case DW_FORM::data4:
+        case DW_FORM::ref4:
+                return 4;
+        case DW_FORM::data8:
+        case DW_FORM::ref_sig8:
+                return 8;
+        default:
+                return -1;
+        }
+}
+
+void
+abbrev_entry::compute_layout(unsigned addr_size, format fmt)
+{
+        fixed_offsets.clear();
+        section_offset offset = 0;
+        fixed_offsets.push_back(offset);
+        for (auto &attr : attributes) {
+                int size = fixed_form_size(attr.form, addr_size, fmt);
+                if (size < 0)
+                        break;
+                offset += size;
+                fixed_offsets.push_back(offset);
+        }
+        fixed_offsets.shrink_to_fit();
+
+        slots.fill(no_slot);
+        // If an attribute appears more than once, the first one wins,
+        // like a linear scan would find
+        for (size_t i = attributes.size(); i-- > 0; ) {
+                unsigned name = (unsigned)attributes[i].name;
+                if (name < max_direct_attr && i < no_slot)
+                        slots[name] = i;
+        }
+}
+
+void
+abbrev_table::read(cursor *cur, unsigned addr_size, format fmt)
+{
+        // Section 7.5.3
+        vec.clear();
+        map.clear();
+        abbrev_entry entry;
+        abbrev_code highest = 0;
+        while (entry.read(cur)) {
+                entry.compute_layout(addr_size, fmt);
+                map[entry.code] = entry;
+                if (entry.code > highest)
+                        highest = entry.code;
+        }
+
+        // Typically, abbrev codes are assigned linearly, so it's more
+        // space efficient and time efficient to store the table in a
+        // vector.  Convert to a vector if it's dense enough, by some
+        // rough estimate of "enough".
+        if (highest * 10 < map.size() * 15) {
+                // Move the map into the vector
+                vec.resize(highest + 1);
+                for (auto &entry : map)
+                        vec[entry.first] = move(entry.second);
+                map.clear();
+        }
+}
+
 DWARFPP_END_NAMESPACE
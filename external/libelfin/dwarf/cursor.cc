@@ -7,14 +7,122 @@
 #include <stdexcept>
 #include <cstring>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 DWARFPP_BEGIN_NAMESPACE
 
+// The number of bytes leb128_terminators examines at once.  With SSE2
+// (which every x86-64 has), a single movemask finds the terminating
+// bytes in a 16 byte window, which covers every LEB128 that fits in
+// 64 bits.  Other little-endian machines look at a 64-bit word.
+// Anything else uses the byte-at-a-time loops.
+#if defined(__SSE2__)
+#define LEB128_WINDOW 16
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LEB128_WINDOW 8
+#endif
+
+#ifdef LEB128_WINDOW
+/**
+ * Return a mask with bit i set if byte i of the LEB128_WINDOW bytes
+ * at p has a clear continuation bit, and hence ends a LEB128.
+ */
+static inline unsigned
+leb128_terminators(const char *p)
+{
+#if LEB128_WINDOW == 16
+        __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+        return ~_mm_movemask_epi8(bytes) & 0xffff;
+#else
+        uint64_t word;
+        memcpy(&word, p, sizeof word);
+        // Gather the inverted continuation bits into the top byte
+        word = (~word & 0x8080808080808080) >> 7;
+        return (word * 0x0102040810204080) >> 56;
+#endif
+}
+
+/**
+ * Decode the len byte LEB128 at p, where len is at most 10 and at
+ * least 8 bytes are readable at p.  Rather than shifting in one byte
+ * at a time, this packs the 7-bit groups of the first eight bytes
+ * together in three steps.
+ */
+static inline uint64_t
+leb128_decode(const char *p, unsigned len)
+{
+        uint64_t word;
+        memcpy(&word, p, sizeof word);
+        if (len < 8)
+                word &= ((uint64_t)1 << (8 * len)) - 1;
+        word &= 0x7f7f7f7f7f7f7f7f;
+        word = (word & 0x007f007f007f007f) | ((word & 0x7f007f007f007f00) >> 1);
+        word = (word & 0x00003fff00003fff) | ((word & 0x3fff00003fff0000) >> 2);
+        word = (word & 0x000000000fffffff) | ((word & 0x0fffffff00000000) >> 4);
+        for (unsigned i = 8; i < len; i++)
+                word |= (uint64_t)(p[i] & 0x7f) << (7 * i);
+        return word;
+}
+
+/**
+ * Return the length of the LEB128 at p if it can be decoded with
+ * leb128_decode, or 0 if not.
+ */
+static inline unsigned
+leb128_length(const char *p, const char *end)
+{
+        if ((size_t)(end - p) < LEB128_WINDOW)
+                return 0;
+        unsigned terminators = leb128_terminators(p);
+        if (!terminators)
+                return 0;
+        unsigned len = __builtin_ctz(terminators) + 1;
+        return len <= 10 ? len : 0;
+}
+#endif
+
+uint64_t
+cursor::uleb128_multibyte()
+{
+        // Appendix C
+#ifdef LEB128_WINDOW
+        if (unsigned len = leb128_length(pos, sec->end)) {
+                uint64_t result = leb128_decode(pos, len);
+                pos += len;
+                return result;
+        }
+#endif
+        std::uint64_t result = 0;
+        int shift = 0;
+        while (pos < sec->end) {
+                uint8_t byte = *(uint8_t*)(pos++);
+                result |= (uint64_t)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                        return result;
+                shift += 7;
+        }
+        underflow();
+        return 0;
+}
+
 int64_t
 cursor::sleb128()
 {
         // Appendix C
+#ifdef LEB128_WINDOW
+        if (unsigned len = leb128_length(pos, sec->end)) {
+                uint64_t result = leb128_decode(pos, len);
+                unsigned shift = 7 * len;
+                if (shift < sizeof(result)*8 && (pos[len - 1] & 0x40))
+                        result |= -((uint64_t)1 << shift);
+                pos += len;
+                return result;
+        }
+#endif
         uint64_t result = 0;
         unsigned shift = 0;
         while (pos < sec->end) {
@@ -31,8 +139,45 @@ cursor::sleb128()
         return 0;
 }
 
+void
+cursor::skip_leb128(size_t n)
+{
+#ifdef LEB128_WINDOW
+        while (n && (size_t)(sec->end - pos) >= LEB128_WINDOW) {
+                unsigned terminators = leb128_terminators(pos);
+                unsigned count = __builtin_popcount(terminators);
+                if (count < n) {
+                        n -= count;
+                        pos += LEB128_WINDOW;
+                        continue;
+                }
+                // The n'th terminator ends the last LEB128 to skip
+                for (; n > 1; n--)
+                        terminators &= terminators - 1;
+                pos += __builtin_ctz(terminators) + 1;
+                return;
+        }
+#endif
+        for (; n; n--) {
+                while (pos < sec->end && (*(uint8_t*)pos & 0x80))
+                        pos++;
+                if (pos >= sec->end)
+                        underflow();
+                pos++;
+        }
+}
+
 shared_ptr<section>
 cursor::subsection()
+{
+        const char *begin = pos;
+        format fmt;
+        section_length length = skip_subsection(&fmt);
+        return make_shared<section>(sec->type, begin, length, sec->ord, fmt);
+}
+
+section_length
+cursor::skip_subsection(format *fmt_out)
 {
         // Section 7.4
         const char *begin = pos;
@@ -49,7 +194,9 @@ cursor::subsection()
                 throw format_error("initial length has reserved value");
         }
         pos = begin + length;
-        return make_shared<section>(sec->type, begin, length, sec->ord, fmt);
+        if (fmt_out)
+                *fmt_out = fmt;
+        return length;
 }
 
 void
@@ -173,9 +320,7 @@ cursor::skip_form(DW_FORM form)
         case DW_FORM::sdata:
         case DW_FORM::udata:
         case DW_FORM::ref_udata:
-                while (pos < sec->end && (*(uint8_t*)pos & 0x80))
-                        pos++;
-                pos++;
+                skip_leb128();
                 break;
         case DW_FORM::string:
                 while (pos < sec->end && *pos)
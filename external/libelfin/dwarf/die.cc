@@ -41,41 +41,57 @@ die::read(section_offset off)
         abbrev = &cu->get_abbrev(acode);
 
         tag = abbrev->tag;
+        attr_start = cur.get_section_offset();
 
-        // XXX We can pre-compute almost all of this work in the
-        // abbrev_entry.
+        // The abbrev knows the offsets of the attributes up to the
+        // first one with a variable size.  Only the attributes from
+        // there on need to be decoded.
         attrs.clear();
-        attrs.reserve(abbrev->attributes.size());
-        for (auto &attr : abbrev->attributes) {
-                attrs.push_back(cur.get_section_offset());
-                cur.skip_form(attr.form);
+        const auto &fixed = abbrev->fixed_offsets;
+        size_t nattrs = abbrev->attributes.size();
+        if (fixed.size() > nattrs) {
+                next = attr_start + fixed.back();
+                return;
+        }
+        cur.pos += fixed.back();
+        for (size_t i = fixed.size() - 1; i < nattrs; i++) {
+                if (i >= fixed.size())
+                        attrs.push_back(cur.get_section_offset());
+                cur.skip_form(abbrev->attributes[i].form);
         }
         next = cur.get_section_offset();
 }
 
+section_offset
+die::attr_offset(size_t i) const
+{
+        const auto &fixed = abbrev->fixed_offsets;
+        if (i < fixed.size())
+                return attr_start + fixed[i];
+        return attrs[i - fixed.size()];
+}
+
+pair<DW_AT, value>
+die::attr_pair(size_t i) const
+{
+        auto &a = abbrev->attributes[i];
+        return make_pair(a.name, value(cu, a.name, a.form, a.type, attr_offset(i)));
+}
+
 bool
 die::has(DW_AT attr) const
 {
-        if (!abbrev)
-                return false;
-        // XXX Totally lame
-        for (auto &a : abbrev->attributes)
-                if (a.name == attr)
-                        return true;
-        return false;
+        return abbrev && abbrev->find_attribute(attr) >= 0;
 }
 
 value
 die::operator[](DW_AT attr) const
 {
-        // XXX We can pre-compute almost all of this work in the
-        // abbrev_entry.
         if (abbrev) {
-                int i = 0;
-                for (auto &a : abbrev->attributes) {
-                        if (a.name == attr)
-                                return value(cu, a.name, a.form, a.type, attrs[i]);
-                        i++;
+                int i = abbrev->find_attribute(attr);
+                if (i >= 0) {
+                        auto &a = abbrev->attributes[i];
+                        return value(cu, a.name, a.form, a.type, attr_offset(i));
                 }
         }
         throw out_of_range("DIE does not have attribute " + to_string(attr));
@@ -93,9 +109,6 @@ die::resolve(DW_AT attr) const
         // completed by its abstract instance, so we first try to
         // resolve abstract_origin, then we resolve specification.
 
-        // XXX This traverses the abbrevs at least twice and
-        // potentially several more times
-
         if (has(attr))
                 return (*this)[attr];
 
@@ -137,6 +150,7 @@ die::iterator::operator++()
         if (!d.abbrev)
                 return *this;
 
+        section_offset sibling;
         if (!d.abbrev->children) {
                 // The DIE has no children, so its successor follows
                 // immediately
@@ -145,12 +159,13 @@ die::iterator::operator++()
                 // They made it easy on us.  Follow the sibling
                 // pointer.  XXX Probably worth optimizing
                 d = d[DW_AT::sibling].as_reference();
+        } else if ((sibling = d.cu->get_sibling_offset(d.offset))) {
+                // The unit knows where its subtree ends, so a DFS
+                // doesn't go through each subtree again
+                d.read(sibling);
         } else {
                 // It's a hard-knock life.  We have to iterate through
                 // the children to find the next DIE.
-                // XXX Particularly unfortunate if the user is doing a
-                // DFS, since this will result in N^2 behavior.  Maybe
-                // a small cache of terminator locations in the CU?
                 iterator sub(d.cu, d.next);
                 while (sub->abbrev)
                         ++sub;
@@ -164,22 +179,56 @@ const vector<pair<DW_AT, value> >
 die::attributes() const
 {
         vector<pair<DW_AT, value> > res;
-
-        if (!abbrev)
-                return res;
-
-        // XXX Quite slow, especially when using this to traverse an
-        // entire DIE tree since each DIE will produce a new vector
-        // (whereas other vectors get reused).  Might be worth a
-        // custom iterator.
-        int i = 0;
-        for (auto &a : abbrev->attributes) {
-                res.push_back(make_pair(a.name, value(cu, a.name, a.form, a.type, attrs[i])));
-                i++;
-        }
+        auto range = attributes_view();
+        res.reserve(range.size());
+        for (auto &attr : range)
+                res.push_back(attr);
         return res;
 }
 
+die::attribute_range
+die::attributes_view() const
+{
+        return attribute_range(this);
+}
+
+die::attribute_iterator::attribute_iterator(const die *d, size_t i)
+        : d(d), i(i)
+{
+        if (i < d->abbrev->attributes.size())
+                attr = d->attr_pair(i);
+}
+
+die::attribute_iterator &
+die::attribute_iterator::operator++()
+{
+        if (++i < d->abbrev->attributes.size())
+                attr = d->attr_pair(i);
+        return *this;
+}
+
+die::attribute_iterator
+die::attribute_range::begin() const
+{
+        if (!d->abbrev)
+                return attribute_iterator();
+        return attribute_iterator(d, 0);
+}
+
+die::attribute_iterator
+die::attribute_range::end() const
+{
+        if (!d->abbrev)
+                return attribute_iterator();
+        return attribute_iterator(d, size());
+}
+
+size_t
+die::attribute_range::size() const
+{
+        return d->abbrev ? d->abbrev->attributes.size() : 0;
+}
+
 bool
 die::operator==(const die &o) const
 {
@@ -5,6 +5,7 @@
 #include "internal.hh"
 
 #include <cstring>
+#include <deque>
 #include <unordered_set>
 
 using namespace std;
@@ -25,52 +26,225 @@ namespace std {
 
 DWARFPP_BEGIN_NAMESPACE
 
-struct string_hash
+// wyhash (final version 4), by Wang Yi, released into the public
+// domain.  This reads the string a word at a time, so it's much
+// faster than a byte-at-a-time hash for identifiers, and it mixes well
+// enough that the table below can use the low bits directly.
+static inline void
+wymum(uint64_t *a, uint64_t *b)
 {
-        typedef size_t result_type;
-        typedef const char *argument_type;
-        result_type operator()(const char *s) const
-        {
-                result_type h = 0;
-                for (; *s; ++s)
-                        h += 33 * h + *s;
-                return h;
-        }
-};
+#ifdef __SIZEOF_INT128__
+        __uint128_t r = *a;
+        r *= *b;
+        *a = (uint64_t)r;
+        *b = (uint64_t)(r >> 64);
+#else
+        uint64_t ha = *a >> 32, hb = *b >> 32;
+        uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+        uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+        uint64_t t = rl + (rm0 << 32), c = t < rl;
+        uint64_t lo = t + (rm1 << 32);
+        c += lo < t;
+        *a = lo;
+        *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
 
-struct string_eq 
+static inline uint64_t
+wymix(uint64_t a, uint64_t b)
 {
-        typedef bool result_type;
-        typedef const char *first_argument_type;
-        typedef const char *second_argument_type;
-        bool operator()(const char *x, const char *y) const
-        {
-                return strcmp(x, y) == 0;
+        wymum(&a, &b);
+        return a ^ b;
+}
+
+static inline uint64_t
+wyr8(const uint8_t *p)
+{
+        uint64_t v;
+        memcpy(&v, p, 8);
+        return v;
+}
+
+static inline uint64_t
+wyr4(const uint8_t *p)
+{
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+}
+
+static uint64_t
+wyhash(const char *key, size_t len)
+{
+        static const uint64_t secret[4] = {
+                0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+        };
+        const uint8_t *p = (const uint8_t*)key;
+        uint64_t seed = wymix(secret[0], secret[1]);
+        uint64_t a, b;
+        if (len <= 16) {
+                if (len >= 4) {
+                        a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+                        b = (wyr4(p + len - 4) << 32) |
+                                wyr4(p + len - 4 - ((len >> 3) << 2));
+                } else if (len > 0) {
+                        a = ((uint64_t)p[0] << 16) |
+                                ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+                        b = 0;
+                } else {
+                        a = b = 0;
+                }
+        } else {
+                size_t i = len;
+                if (i > 48) {
+                        uint64_t see1 = seed, see2 = seed;
+                        do {
+                                seed = wymix(wyr8(p) ^ secret[1],
+                                             wyr8(p + 8) ^ seed);
+                                see1 = wymix(wyr8(p + 16) ^ secret[2],
+                                             wyr8(p + 24) ^ see1);
+                                see2 = wymix(wyr8(p + 32) ^ secret[3],
+                                             wyr8(p + 40) ^ see2);
+                                p += 48;
+                                i -= 48;
+                        } while (i > 48);
+                        seed ^= see1 ^ see2;
+                }
+                while (i > 16) {
+                        seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+                        i -= 16;
+                        p += 16;
+                }
+                a = wyr8(p + i - 16);
+                b = wyr8(p + i - 8);
         }
-};
+        a ^= secret[1];
+        b ^= seed;
+        wymum(&a, &b);
+        return wymix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
 
 struct die_str_map::impl
 {
         impl(const die &parent, DW_AT attr,
              const initializer_list<DW_TAG> &accept)
                 : attr(attr), accept(accept.begin(), accept.end()),
-                  pos(parent.begin()), end(parent.end()) { }
+                  pos(parent.begin()), end(parent.end()), used(0) { }
 
-        unordered_map<const char*, die, string_hash, string_eq> str_map;
         DW_AT attr;
         unordered_set<DW_TAG> accept;
         die::iterator pos, end;
         die invalid;
+
+        // The DIEs indexed so far.  This is a deque so references
+        // returned by earlier lookups survive later insertions.
+        deque<die> dies;
+
+        // An open-addressed hash table over dies, probed linearly
+        // from the low bits of the hash.  The strings themselves
+        // aren't copied; str points into the DWARF data (usually
+        // .debug_str).  A slot with a null str is empty.  Comparing
+        // hashes first means a probe almost never compares strings
+        // that don't match.
+        struct slot
+        {
+                uint64_t hash;
+                const char *str;
+                size_t len;
+                size_t index;
+        };
+        vector<slot> slots;
+        size_t used;
+
+        const die *find(uint64_t hash, const char *str, size_t len) const
+        {
+                if (slots.empty())
+                        return nullptr;
+                size_t mask = slots.size() - 1;
+                for (size_t i = hash & mask; slots[i].str; i = (i + 1) & mask) {
+                        const slot &s = slots[i];
+                        if (s.hash == hash && s.len == len &&
+                            memcmp(s.str, str, len) == 0)
+                                return &dies[s.index];
+                }
+                return nullptr;
+        }
+
+        void insert_slot(const slot &n)
+        {
+                size_t mask = slots.size() - 1;
+                size_t i = n.hash & mask;
+                while (slots[i].str)
+                        i = (i + 1) & mask;
+                slots[i] = n;
+        }
+
+        /**
+         * Add d under str unless an earlier DIE already has that
+         * string, and return the DIE now indexed under str.
+         */
+        const die &insert(uint64_t hash, const char *str, size_t len,
+                          const die &d)
+        {
+                if (const die *prev = find(hash, str, len))
+                        return *prev;
+                // Keep the load factor at most 1/2
+                if (2 * (used + 1) > slots.size()) {
+                        vector<slot> old(max<size_t>(16, 2 * slots.size()));
+                        old.swap(slots);
+                        for (auto &s : old)
+                                if (s.str)
+                                        insert_slot(s);
+                }
+                dies.push_back(d);
+                insert_slot(slot{hash, str, len, dies.size() - 1});
+                used++;
+                return dies.back();
+        }
+
+        /**
+         * Index the next child, if it is accepted.  Returns the
+         * indexed DIE and sets *hash_out and *str_out, or returns
+         * nullptr if the child was skipped.  pos must not be end.
+         */
+        const die *scan_next(uint64_t *hash_out, const char **str_out,
+                             size_t *len_out)
+        {
+                const die &d = *pos;
+                const die *res = nullptr;
+                if (accept.count(d.tag) && d.has(attr)) {
+                        value dval(d[attr]);
+                        if (dval.get_type() == value::type::string) {
+                                size_t len;
+                                const char *str = dval.as_cstr(&len);
+                                uint64_t hash = wyhash(str, len);
+                                res = &insert(hash, str, len, d);
+                                *hash_out = hash;
+                                *str_out = str;
+                                *len_out = len;
+                        }
+                }
+                ++pos;
+                return res;
+        }
 };
 
 die_str_map::die_str_map(const die &parent, DW_AT attr,
-                         const initializer_list<DW_TAG> &accept)
+                         const initializer_list<DW_TAG> &accept, bool eager)
         : m(make_shared<impl>(parent, attr, accept))
 {
+        if (eager) {
+                uint64_t hash;
+                const char *str;
+                size_t len;
+                while (m->pos != m->end)
+                        m->scan_next(&hash, &str, &len);
+        }
 }
 
 die_str_map
-die_str_map::from_type_names(const die &parent)
+die_str_map::from_type_names(const die &parent, bool eager)
 {
         return die_str_map
                 (parent, DW_AT::name,
@@ -86,30 +260,27 @@ die_str_map::from_type_names(const die &parent)
                   DW_TAG::file_type, DW_TAG::packed_type,
                   DW_TAG::volatile_type, DW_TAG::restrict_type,
                   DW_TAG::interface_type, DW_TAG::unspecified_type,
-                  DW_TAG::shared_type, DW_TAG::rvalue_reference_type});
+                  DW_TAG::shared_type, DW_TAG::rvalue_reference_type},
+                 eager);
 }
 
 const die &
 die_str_map::operator[](const char *val) const
 {
         // Do we have this value?
-        auto it = m->str_map.find(val);
-        if (it != m->str_map.end())
-                return it->second;
+        size_t len = strlen(val);
+        uint64_t hash = wyhash(val, len);
+        if (const die *d = m->find(hash, val, len))
+                return *d;
         // Read more until we find the value or the end
         while (m->pos != m->end) {
-                const die &d = *m->pos;
-                ++m->pos;
-
-                if (!m->accept.count(d.tag) || !d.has(m->attr))
-                        continue;
-                value dval(d[m->attr]);
-                if (dval.get_type() != value::type::string)
-                        continue;
-                const char *dstr = dval.as_cstr();
-                m->str_map[dstr] = d;
-                if (strcmp(val, dstr) == 0)
-                        return m->str_map[dstr];
+                uint64_t dhash;
+                const char *dstr;
+                size_t dlen;
+                const die *d = m->scan_next(&dhash, &dstr, &dlen);
+                if (d && dhash == hash && dlen == len &&
+                    memcmp(dstr, val, len) == 0)
+                        return *d;
         }
         // Not found
         return m->invalid;
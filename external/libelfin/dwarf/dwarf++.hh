@@ -38,6 +38,7 @@ class line_table;
 // Internal type forward-declarations
 struct section;
 struct abbrev_entry;
+struct abbrev_table;
 struct cursor;
 
 // XXX Audit for binary-compatibility
@@ -55,7 +56,7 @@ struct cursor;
 
 // XXX Indicate DWARF4 in all spec references
 
-// XXX Big missing support: .debug_aranges, .debug_frame, loclists,
+// XXX Big missing support: .debug_frame, loclists,
 // macros
 
 //////////////////////////////////////////////////////////////////
@@ -159,12 +160,40 @@ public:
          */
         const type_unit &get_type_unit(uint64_t type_signature) const;
 
+        /**
+         * Return the DIE at the given offset in the .debug_info
+         * section.  The containing compilation unit is found by
+         * binary search over the unit offsets, so this is the cheap
+         * way to get back to a DIE whose section offset was stored
+         * earlier.  Throws out_of_range if the offset does not fall
+         * within a compilation unit.
+         */
+        die get_die(section_offset offset) const;
+
+        /**
+         * Return the compilation unit whose code contains pc.  The
+         * address map is built on first use from .debug_aranges and,
+         * for units not described there (or if the section is
+         * missing), from the ranges of the unit DIEs.  Lookups are a
+         * binary search.  Throws out_of_range if no unit contains pc.
+         */
+        const compilation_unit &get_compilation_unit(taddr pc) const;
+
         /**
          * \internal Retrieve the specified section from this file.
          * If the section does not exist, throws format_error.
          */
         std::shared_ptr<section> get_section(section_type type) const;
 
+        /**
+         * \internal Return the abbrev table at the given offset in
+         * .debug_abbrev, laid out for a unit with the address size
+         * and format of unit_data.  Each table is parsed at most
+         * once and shared by all the units that use it.
+         */
+        std::shared_ptr<const abbrev_table>
+        get_abbrev_table(section_offset offset, const section &unit_data) const;
+
 private:
         struct impl;
         std::shared_ptr<impl> m;
@@ -247,6 +276,15 @@ public:
          */
         const abbrev_entry &get_abbrev(std::uint64_t acode) const;
 
+        /**
+         * \internal Return the offset of the next sibling of the
+         * DIE at the given unit offset, which has children but no
+         * DW_AT_sibling, or 0 if it is not known.  The first call
+         * finds the siblings of all such DIEs in one pass over the
+         * unit.
+         */
+        section_offset get_sibling_offset(section_offset off) const;
+
 protected:
         friend struct ::std::hash<unit>;
         struct impl;
@@ -416,10 +454,23 @@ public:
          */
         const std::vector<std::pair<DW_AT, value> > attributes() const;
 
+        class attribute_iterator;
+        class attribute_range;
+
+        /**
+         * Return a range over the attributes of this DIE.  Unlike
+         * attributes(), this builds each attribute's value as the
+         * iteration reaches it, so walking the attributes of every
+         * DIE in a tree doesn't allocate.  This DIE must outlive the
+         * range.
+         */
+        attribute_range attributes_view() const;
+
         bool operator==(const die &o) const;
         bool operator!=(const die &o) const;
 
 private:
+        friend class dwarf;
         friend class unit;
         friend class type_unit;
         friend class value;
@@ -433,9 +484,13 @@ private:
         const abbrev_entry *abbrev;
         // The beginning of this DIE, relative to the CU.
         section_offset offset;
-        // Offsets of attributes, relative to cu's subsection.  The
-        // vast majority of DIEs tend to have six or fewer attributes,
-        // so we reserve space in the DIE itself for six attributes.
+        // The beginning of this DIE's attributes, relative to cu's
+        // subsection.
+        section_offset attr_start;
+        // Offsets of the attributes whose offset is not fixed by the
+        // abbrev, relative to cu's subsection.  Most DIEs have at
+        // most a few of these, so we reserve space in the DIE itself
+        // for six attributes.
         small_vector<section_offset, 6> attrs;
         // The offset of the next DIE, relative to cu'd subsection.
         // This is set even for sibling list terminators.
@@ -447,6 +502,17 @@ private:
          * Read this DIE from the given offset in cu.
          */
         void read(section_offset off);
+
+        /**
+         * Return the offset of the i'th attribute, relative to cu's
+         * subsection.
+         */
+        section_offset attr_offset(size_t i) const;
+
+        /**
+         * Return the i'th attribute and its value.
+         */
+        std::pair<DW_AT, value> attr_pair(size_t i) const;
 };
 
 /**
@@ -721,6 +787,70 @@ to_string(value::type v);
 std::string
 to_string(const value &v);
 
+/**
+ * An iterator over the attributes of a DIE.  Like die::iterator, the
+ * attribute it points to is only valid until it is incremented.
+ */
+class die::attribute_iterator
+{
+public:
+        attribute_iterator() : d(nullptr), i(0) { }
+        attribute_iterator(const attribute_iterator &o) = default;
+        attribute_iterator(attribute_iterator &&o) = default;
+
+        attribute_iterator& operator=(const attribute_iterator &o) = default;
+        attribute_iterator& operator=(attribute_iterator &&o) = default;
+
+        const std::pair<DW_AT, value> &operator*() const
+        {
+                return attr;
+        }
+
+        const std::pair<DW_AT, value> *operator->() const
+        {
+                return &attr;
+        }
+
+        bool operator!=(const attribute_iterator &o) const
+        {
+                return i != o.i || d != o.d;
+        }
+
+        attribute_iterator &operator++();
+
+private:
+        friend class die;
+
+        attribute_iterator(const die *d, size_t i);
+
+        const die *d;
+        // The index of the current attribute in d's abbrev
+        size_t i;
+        std::pair<DW_AT, value> attr;
+};
+
+/**
+ * The attributes of a DIE, as returned by die::attributes_view().
+ */
+class die::attribute_range
+{
+public:
+        attribute_iterator begin() const;
+        attribute_iterator end() const;
+
+        /**
+         * Return the number of attributes in this range.
+         */
+        size_t size() const;
+
+private:
+        friend class die;
+
+        explicit attribute_range(const die *d) : d(d) { }
+
+        const die *d;
+};
+
 //////////////////////////////////////////////////////////////////
 // Expressions and location descriptions
 //
@@ -1126,7 +1256,9 @@ public:
          * Return an iterator to the line table entry containing addr
          * (roughly, the entry with the highest address less than or
          * equal to addr, but accounting for end_sequence entries).
-         * Returns end() if there is no such entry.
+         * Returns end() if there is no such entry.  The line number
+         * program is decoded once, on first use of the table, so
+         * this is a binary search over the decoded entries.
          */
         iterator find_address(taddr addr) const;
 
@@ -1281,9 +1413,9 @@ class line_table::iterator
 public:
         /**
          * \internal Construct an iterator for the given line table
-         * starting pos bytes into the table's section.
+         * starting at the row'th entry of the decoded table.
          */
-        iterator(const line_table *table, section_offset pos);
+        iterator(const line_table *table, std::size_t row);
 
         /** Copy constructor */
         iterator(const iterator &o) = default;
@@ -1312,7 +1444,7 @@ public:
         /** Equality operator */
         bool operator==(const iterator &o) const
         {
-                return o.pos == pos && o.table == table;
+                return o.row == row && o.table == table;
         }
 
         /** Inequality operator */
@@ -1337,14 +1469,14 @@ public:
 
 private:
         const line_table *table;
-        line_table::entry entry, regs;
-        section_offset pos;
+        line_table::entry entry;
+        std::size_t row;
 
         /**
-         * Process the next opcode.  If the opcode "adds a row to the
-         * table", update entry to reflect the row and return true.
+         * Fill in entry from the current row, unless this is the end
+         * iterator.
          */
-        bool step(cursor *cur);
+        void load_row();
 };
 
 //////////////////////////////////////////////////////////////////
@@ -1430,18 +1562,28 @@ rangelist die_pc_range(const die &d);
 //
 
 /**
- * An index of sibling DIEs by some string attribute.  This index is
- * lazily constructed and space-efficient.
+ * An index of sibling DIEs by some string attribute.  By default,
+ * this index is lazily constructed: a lookup that misses reads
+ * children until it finds the string, so a lookup of a string that
+ * isn't there reads all of them.  An eager index reads all of the
+ * children up front, after which every lookup, hit or miss, is a
+ * single hash table probe.  An eager index is never modified by
+ * lookups, so it can be shared between threads.
+ *
+ * If several children have the same string, lookups return the first
+ * of them.
  */
 class die_str_map
 {
 public:
         /**
          * Construct the index of the attr attribute of all immediate
-         * children of parent whose tags are in accept.
+         * children of parent whose tags are in accept.  If eager is
+         * true, build the whole index now.
          */
         die_str_map(const die &parent, DW_AT attr,
-                    const std::initializer_list<DW_TAG> &accept);
+                    const std::initializer_list<DW_TAG> &accept,
+                    bool eager = false);
 
         die_str_map() = default;
         die_str_map(const die_str_map &o) = default;
@@ -1457,7 +1599,8 @@ public:
          * XXX This should use .debug_pubtypes if parent is a compile
          * unit's root DIE, but it currently does not.
          */
-        static die_str_map from_type_names(const die &parent);
+        static die_str_map from_type_names(const die &parent,
+                                           bool eager = false);
 
         /**
          * Return the DIE whose attribute matches val.  If no such DIE
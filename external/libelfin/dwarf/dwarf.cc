@@ -4,6 +4,10 @@
 
 #include "internal.hh"
 
+#include <algorithm>
+#include <mutex>
+#include <tuple>
+
 using namespace std;
 
 DWARFPP_BEGIN_NAMESPACE
@@ -15,19 +19,67 @@ DWARFPP_BEGIN_NAMESPACE
 struct dwarf::impl
 {
         impl(const std::shared_ptr<loader> &l)
-                : l(l), have_type_units(false) { }
+                : l(l) { }
 
         std::shared_ptr<loader> l;
 
         std::shared_ptr<section> sec_info;
         std::shared_ptr<section> sec_abbrev;
 
+        // The lazily loaded state below may be populated from several
+        // threads at once, for example when indexing units in
+        // parallel.
+
+        // Compilation units are found by hopping from one unit
+        // header to the next, which only reads their lengths.  The
+        // unit objects themselves are constructed the first time
+        // they are used, so looking up a few DIEs or addresses in a
+        // large binary only touches the units involved.  Their slots
+        // are allocated up front so references to them stay valid.
+        std::vector<section_offset> unit_offsets;
         std::vector<compilation_unit> compilation_units;
+        std::unique_ptr<std::once_flag[]> unit_once;
+        std::once_flag units_once;
+        std::once_flag all_units_once;
 
         std::unordered_map<uint64_t, type_unit> type_units;
-        bool have_type_units;
+        std::once_flag type_units_once;
 
         std::map<section_type, std::shared_ptr<section> > sections;
+        std::mutex sections_mutex;
+
+        // Abbrev tables, keyed by .debug_abbrev offset and the
+        // address size and format they were laid out for.  The mutex
+        // only guards the map; each table is parsed under its own
+        // once_flag, so units using different tables don't wait for
+        // each other.
+        struct shared_abbrev_table
+        {
+                std::once_flag once;
+                std::shared_ptr<abbrev_table> table;
+        };
+        std::map<std::tuple<section_offset, unsigned, format>,
+                 std::shared_ptr<shared_abbrev_table> > abbrev_tables;
+        std::mutex abbrev_tables_mutex;
+
+        // Address ranges of the compilation units, sorted by low.
+        // Ranges can overlap, so max_high is the highest high of
+        // this and all preceding ranges, which bounds how far back a
+        // lookup has to search.
+        struct arange
+        {
+                taddr low, high, max_high;
+                size_t cu;
+        };
+        std::vector<arange> aranges;
+        std::once_flag aranges_once;
+
+        void find_units();
+        const compilation_unit &get_unit(const dwarf &dw, size_t index);
+        void read_aranges(const dwarf &dw);
+        // Throws format_error for a .debug_aranges this can't read
+        void read_aranges_section(const std::shared_ptr<section> &sec,
+                                  std::vector<bool> *covered);
 };
 
 dwarf::dwarf(const std::shared_ptr<loader> &l)
@@ -60,37 +112,58 @@ dwarf::dwarf(const std::shared_ptr<loader> &l)
         if (!data)
                 throw format_error("required .debug_abbrev section missing");
         m->sec_abbrev = make_shared<section>(section_type::abbrev, data, size, m->sec_info->ord);
-
-        // Get compilation units.  Everything derives from these, so
-        // there's no point in doing it lazily.
-        cursor infocur(m->sec_info);
-        while (!infocur.end()) {
-                // XXX Circular reference.  Given that we now require
-                // the dwarf object to stick around for DIEs, maybe we
-                // might as well require that for units, too.
-                m->compilation_units.emplace_back(
-                        *this, infocur.get_section_offset());
-                infocur.subsection();
-        }
 }
 
 dwarf::~dwarf()
 {
 }
 
+void
+dwarf::impl::find_units()
+{
+        call_once(units_once, [this]() {
+                cursor infocur(sec_info);
+                while (!infocur.end()) {
+                        unit_offsets.push_back(infocur.get_section_offset());
+                        infocur.skip_subsection();
+                }
+                compilation_units.resize(unit_offsets.size());
+                unit_once.reset(new std::once_flag[unit_offsets.size()]);
+        });
+}
+
+const compilation_unit &
+dwarf::impl::get_unit(const dwarf &dw, size_t index)
+{
+        find_units();
+        call_once(unit_once[index], [&]() {
+                // XXX Circular reference.  Given that we now require
+                // the dwarf object to stick around for DIEs, maybe we
+                // might as well require that for units, too.
+                compilation_units[index] =
+                        compilation_unit(dw, unit_offsets[index]);
+        });
+        return compilation_units[index];
+}
+
 const std::vector<compilation_unit> &
 dwarf::compilation_units() const
 {
         static std::vector<compilation_unit> empty;
         if (!m)
                 return empty;
+        call_once(m->all_units_once, [this]() {
+                m->find_units();
+                for (size_t i = 0; i < m->unit_offsets.size(); i++)
+                        m->get_unit(*this, i);
+        });
         return m->compilation_units;
 }
 
 const type_unit &
 dwarf::get_type_unit(uint64_t type_signature) const
 {
-        if (!m->have_type_units) {
+        call_once(m->type_units_once, [this]() {
                 cursor tucur(get_section(section_type::types));
                 while (!tucur.end()) {
                         // XXX Circular reference
@@ -98,13 +171,151 @@ dwarf::get_type_unit(uint64_t type_signature) const
                         m->type_units[tu.get_type_signature()] = tu;
                         tucur.subsection();
                 }
-                m->have_type_units = true;
-        }
+        });
         if (!m->type_units.count(type_signature))
                 throw out_of_range("type signature 0x" + to_hex(type_signature));
         return m->type_units[type_signature];
 }
 
+die
+dwarf::get_die(section_offset offset) const
+{
+        m->find_units();
+        auto &offsets = m->unit_offsets;
+        // First unit that starts after offset; the one before it
+        // contains offset
+        auto it = std::upper_bound(offsets.begin(), offsets.end(), offset);
+        if (it == offsets.begin())
+                throw out_of_range("DIE offset 0x" + to_hex(offset));
+        --it;
+        const compilation_unit &cu = m->get_unit(*this, it - offsets.begin());
+        if (offset >= *it + cu.data()->size())
+                throw out_of_range("DIE offset 0x" + to_hex(offset));
+
+        die d(&cu);
+        d.read(offset - *it);
+        return d;
+}
+
+const compilation_unit &
+dwarf::get_compilation_unit(taddr pc) const
+{
+        call_once(m->aranges_once, [this]() { m->read_aranges(*this); });
+
+        auto &ar = m->aranges;
+        auto it = std::upper_bound(
+                ar.begin(), ar.end(), pc,
+                [](taddr pc, const impl::arange &a) { return pc < a.low; });
+        while (it != ar.begin()) {
+                --it;
+                if (pc < it->high)
+                        return m->get_unit(*this, it->cu);
+                if (it->max_high <= pc)
+                        break;
+        }
+        throw out_of_range("no compilation unit contains 0x" + to_hex(pc));
+}
+
+void
+dwarf::impl::read_aranges(const dwarf &dw)
+{
+        // Start over if a previous attempt threw part way through
+        aranges.clear();
+        find_units();
+        std::vector<bool> covered(unit_offsets.size());
+        std::shared_ptr<section> sec;
+        try {
+                sec = dw.get_section(section_type::aranges);
+        } catch (format_error &e) {
+                // Not all compilers emit .debug_aranges (clang
+                // doesn't by default)
+        }
+
+        try {
+                if (sec)
+                        read_aranges_section(sec, &covered);
+        } catch (format_error &e) {
+                // Find the ranges of all units from their DIEs
+                // instead
+                aranges.clear();
+                covered.assign(covered.size(), false);
+        } catch (underflow_error &e) {
+                aranges.clear();
+                covered.assign(covered.size(), false);
+        }
+
+        // Units without aranges have to be read to find their
+        // ranges.  A unit whose ranges can't be read can't be found
+        // by pc, but the others still can.
+        for (size_t i = 0; i < unit_offsets.size(); i++) {
+                if (covered[i])
+                        continue;
+                try {
+                        die root = get_unit(dw, i).root();
+                        if (!root.has(DW_AT::low_pc) && !root.has(DW_AT::ranges))
+                                continue;
+                        for (auto &r : die_pc_range(root))
+                                if (r.low < r.high)
+                                        aranges.push_back({r.low, r.high, 0, i});
+                } catch (format_error &e) {
+                } catch (value_type_mismatch &e) {
+                } catch (underflow_error &e) {
+                }
+        }
+
+        std::sort(aranges.begin(), aranges.end(),
+                  [](const arange &a, const arange &b) { return a.low < b.low; });
+        taddr max_high = 0;
+        for (auto &a : aranges) {
+                max_high = max(max_high, a.high);
+                a.max_high = max_high;
+        }
+}
+
+void
+dwarf::impl::read_aranges_section(const std::shared_ptr<section> &sec,
+                                  std::vector<bool> *covered)
+{
+        // DWARF4 section 6.1.2
+        cursor cur(sec);
+        while (!cur.end()) {
+                auto set = cur.subsection();
+                cursor sub(set);
+                sub.skip_initial_length();
+                uhalf version = sub.fixed<uhalf>();
+                if (version != 2)
+                        throw format_error("unknown .debug_aranges version " +
+                                           std::to_string(version));
+                section_offset info_offset = sub.offset();
+                ubyte addr_size = sub.fixed<ubyte>();
+                ubyte seg_size = sub.fixed<ubyte>();
+                if (seg_size != 0)
+                        throw format_error("segmented .debug_aranges not supported");
+
+                auto cu = std::lower_bound(unit_offsets.begin(),
+                                           unit_offsets.end(), info_offset);
+                if (cu == unit_offsets.end() || *cu != info_offset)
+                        throw format_error(".debug_aranges set refers to unknown unit 0x" +
+                                           to_hex(info_offset));
+                size_t index = cu - unit_offsets.begin();
+                (*covered)[index] = true;
+
+                // The tuples are aligned to twice the address size
+                // from the start of the set
+                section_offset tuple = 2 * addr_size;
+                section_offset start = (sub.get_section_offset() + tuple - 1) / tuple * tuple;
+                cursor tuples(set->slice(0, set->size(), set->fmt, addr_size), start);
+                while (!tuples.end()) {
+                        taddr low = tuples.address();
+                        taddr length = tuples.address();
+                        if (low == 0 && length == 0)
+                                break;
+                        if (length)
+                                aranges.push_back({low, low + length, 0, index});
+                }
+        }
+}
+
 std::shared_ptr<section>
 dwarf::get_section(section_type type) const
 {
@@ -113,6 +324,7 @@ dwarf::get_section(section_type type) const
         if (type == section_type::abbrev)
                 return m->sec_abbrev;
 
+        lock_guard<mutex> lock(m->sections_mutex);
         auto it = m->sections.find(type);
         if (it != m->sections.end())
                 return it->second;
@@ -126,6 +338,27 @@ dwarf::get_section(section_type type) const
         return m->sections[type];
 }
 
+std::shared_ptr<const abbrev_table>
+dwarf::get_abbrev_table(section_offset offset, const section &unit_data) const
+{
+        std::shared_ptr<impl::shared_abbrev_table> shared;
+        {
+                lock_guard<mutex> lock(m->abbrev_tables_mutex);
+                auto &slot = m->abbrev_tables[make_tuple(
+                        offset, unit_data.addr_size, unit_data.fmt)];
+                if (!slot)
+                        slot = make_shared<impl::shared_abbrev_table>();
+                shared = slot;
+        }
+        call_once(shared->once, [&]() {
+                auto table = make_shared<abbrev_table>();
+                cursor c(m->sec_abbrev, offset);
+                table->read(&c, unit_data.addr_size, unit_data.fmt);
+                shared->table = table;
+        });
+        return shared->table;
+}
+
 //////////////////////////////////////////////////////////////////
 // class unit
 //
@@ -145,18 +378,29 @@ struct unit::impl
         const uint64_t type_signature;
         const section_offset type_offset;
 
-        // Lazily constructed root and type DIEs
+        // Lazily constructed root and type DIEs.  Like the rest of
+        // the lazy state, these are populated at most once, even if
+        // several threads ask for them at the same time.
         die root, type;
+        std::once_flag root_once, type_once;
 
         // Lazily constructed line table
         line_table lt;
-
-        // Map from abbrev code to abbrev.  If the map is dense, it
-        // will be stored in the vector; otherwise it will be stored
-        // in the map.
-        bool have_abbrevs;
-        std::vector<abbrev_entry> abbrevs_vec;
-        std::unordered_map<abbrev_code, abbrev_entry> abbrevs_map;
+        std::once_flag lt_once;
+
+        // This unit's abbrev table, shared with the other units
+        // that use it
+        std::once_flag abbrevs_once;
+        std::shared_ptr<const abbrev_table> abbrevs;
+
+        // The DIEs which have children but no DW_AT_sibling, sorted
+        // by offset, and the offsets of their next siblings.  These
+        // are found in one pass over the unit the first time an
+        // iterator has to step over such a DIE.  GCC gives almost
+        // every DIE with children a DW_AT_sibling, so for its units
+        // the table stays small.
+        std::once_flag siblings_once;
+        std::vector<uint32_t> sibling_dies, siblings;
 
         impl(const dwarf &file, section_offset offset,
              const std::shared_ptr<section> &subsec,
@@ -165,7 +409,9 @@ struct unit::impl
                 : file(file), offset(offset), subsec(subsec),
                   debug_abbrev_offset(debug_abbrev_offset),
                   root_offset(root_offset), type_signature(type_signature),
-                  type_offset(type_offset), have_abbrevs(false) { }
+                  type_offset(type_offset)
+        {
+        }
 
         void force_abbrevs();
 };
@@ -189,11 +435,11 @@ unit::get_section_offset() const
 const die&
 unit::root() const
 {
-        if (!m->root.valid()) {
+        call_once(m->root_once, [this]() {
                 m->force_abbrevs();
                 m->root = die(this);
                 m->root.read(m->root_offset);
-        }
+        });
         return m->root;
 }
 
@@ -206,59 +452,87 @@ unit::data() const
 const abbrev_entry &
 unit::get_abbrev(abbrev_code acode) const
 {
-        if (!m->have_abbrevs)
-                m->force_abbrevs();
+        m->force_abbrevs();
 
-        if (!m->abbrevs_vec.empty()) {
-                if (acode >= m->abbrevs_vec.size())
-                        goto unknown;
-                const abbrev_entry &entry = m->abbrevs_vec[acode];
-                if (entry.code == 0)
-                        goto unknown;
-                return entry;
-        } else {
-                auto it = m->abbrevs_map.find(acode);
-                if (it == m->abbrevs_map.end())
-                        goto unknown;
-                return it->second;
-        }
+        const abbrev_entry *entry = m->abbrevs->find(acode);
+        if (!entry)
+                throw format_error("unknown abbrev code 0x" + to_hex(acode));
+        return *entry;
+}
 
-unknown:
-        throw format_error("unknown abbrev code 0x" + to_hex(acode));
+section_offset
+unit::get_sibling_offset(section_offset off) const
+{
+        call_once(m->siblings_once, [this]() {
+                // Only units under 4GB fit in the table, which is all
+                // but the most pathological
+                if (m->subsec->size() > 0xffffffff)
+                        return;
+
+                // The DIEs whose children haven't ended yet, as
+                // indexes into the table, or npos for those with a
+                // DW_AT_sibling
+                const size_t npos = ~size_t(0);
+                std::vector<size_t> open;
+                auto &dies = m->sibling_dies;
+                auto &sibs = m->siblings;
+                die d(this);
+                try {
+                        for (section_offset pos = m->root_offset;
+                             pos < m->subsec->size(); pos = d.next) {
+                                d.read(pos);
+                                if (!d.abbrev) {
+                                        // Padding after the root's
+                                        // children is also all zeros
+                                        if (open.empty())
+                                                continue;
+                                        if (open.back() != npos)
+                                                sibs[open.back()] = d.next;
+                                        open.pop_back();
+                                } else if (!d.abbrev->children) {
+                                        continue;
+                                } else if (d.has(DW_AT::sibling)) {
+                                        open.push_back(npos);
+                                } else {
+                                        open.push_back(dies.size());
+                                        dies.push_back(pos);
+                                        sibs.push_back(0);
+                                }
+                        }
+                } catch (format_error &e) {
+                        // The DIEs before the bad one are still
+                        // worth having
+                } catch (underflow_error &e) {
+                }
+
+                // A DIE whose children didn't end before the unit
+                // did is stepped over the slow way
+                size_t n = 0;
+                for (size_t i = 0; i < dies.size(); i++) {
+                        if (sibs[i]) {
+                                dies[n] = dies[i];
+                                sibs[n++] = sibs[i];
+                        }
+                }
+                dies.resize(n);
+                dies.shrink_to_fit();
+                sibs.resize(n);
+                sibs.shrink_to_fit();
+        });
+
+        auto &dies = m->sibling_dies;
+        auto it = lower_bound(dies.begin(), dies.end(), off);
+        if (it == dies.end() || *it != off)
+                return 0;
+        return m->siblings[it - dies.begin()];
 }
 
 void
 unit::impl::force_abbrevs()
 {
-        // XXX Compilation units can share abbrevs.  Parse each table
-        // at most once.
-        if (have_abbrevs)
-                return;
-
-        // Section 7.5.3
-        cursor c(file.get_section(section_type::abbrev),
-                 debug_abbrev_offset);
-        abbrev_entry entry;
-        abbrev_code highest = 0;
-        while (entry.read(&c)) {
-                abbrevs_map[entry.code] = entry;
-                if (entry.code > highest)
-                        highest = entry.code;
-        }
-
-        // Typically, abbrev codes are assigned linearly, so it's more
-        // space efficient and time efficient to store the table in a
-        // vector.  Convert to a vector if it's dense enough, by some
-        // rough estimate of "enough".
-        if (highest * 10 < abbrevs_map.size() * 15) {
-                // Move the map into the vector
-                abbrevs_vec.resize(highest + 1);
-                for (auto &entry : abbrevs_map)
-                        abbrevs_vec[entry.first] = move(entry.second);
-                abbrevs_map.clear();
-        }
-
-        have_abbrevs = true;
+        call_once(abbrevs_once, [this]() {
+                abbrevs = file.get_abbrev_table(debug_abbrev_offset, *subsec);
+        });
 }
 
 //////////////////////////////////////////////////////////////////
@@ -287,16 +561,16 @@ compilation_unit::compilation_unit(const dwarf &file, section_offset offset)
 const line_table &
 compilation_unit::get_line_table() const
 {
-        if (!m->lt.valid()) {
+        call_once(m->lt_once, [this]() {
                 const die &d = root();
                 if (!d.has(DW_AT::stmt_list) || !d.has(DW_AT::name))
-                        goto done;
+                        return;
 
                 shared_ptr<section> sec;
                 try {
                         sec = m->file.get_section(section_type::line);
                 } catch (format_error &e) {
-                        goto done;
+                        return;
                 }
 
                 auto comp_dir = d.has(DW_AT::comp_dir) ? at_comp_dir(d) : "";
@@ -304,8 +578,7 @@ compilation_unit::get_line_table() const
                 m->lt = line_table(sec, d[DW_AT::stmt_list].as_sec_offset(),
                                    m->subsec->addr_size, comp_dir,
                                    at_name(d));
-        }
-done:
+        });
         return m->lt;
 }
 
@@ -344,11 +617,11 @@ type_unit::get_type_signature() const
 const die &
 type_unit::type() const
 {
-        if (!m->type.valid()) {
+        call_once(m->type_once, [this]() {
                 m->force_abbrevs();
                 m->type = die(this);
                 m->type.read(m->type_offset);
-        }
+        });
         return m->type;
 }
 
@@ -8,6 +8,7 @@
 #include "dwarf++.hh"
 #include "../elf/to_hex.hh"
 
+#include <array>
 #include <stdexcept>
 #include <type_traits>
 #include <unordered_map>
@@ -114,6 +115,12 @@ struct cursor
          * skip_initial_length).
          */
         std::shared_ptr<section> subsection();
+        /**
+         * Skip over a subsection without constructing it, like
+         * subsection() does.  Returns the length of the subsection,
+         * including its initial length.
+         */
+        section_length skip_subsection(format *fmt_out = nullptr);
         std::int64_t sleb128();
         section_offset offset();
         void string(std::string &out);
@@ -146,21 +153,30 @@ struct cursor
 
         std::uint64_t uleb128()
         {
-                // Appendix C
-                // XXX Pre-compute all two byte ULEB's
-                std::uint64_t result = 0;
-                int shift = 0;
-                while (pos < sec->end) {
-                        uint8_t byte = *(uint8_t*)(pos++);
-                        result |= (uint64_t)(byte & 0x7f) << shift;
-                        if ((byte & 0x80) == 0)
-                                return result;
-                        shift += 7;
-                }
-                underflow();
-                return 0;
+                // Appendix C.  Most ULEB128s (abbrev codes, in
+                // particular) are a single byte, so handle those
+                // inline.
+                if (pos < sec->end && !(*(const uint8_t*)pos & 0x80))
+                        return *(const uint8_t*)pos++;
+                return uleb128_multibyte();
         }
 
+        /**
+         * Decode a ULEB128 that may be longer than one byte.  This
+         * finds the terminating byte of the LEB128 with a single
+         * vector compare and decodes all of its bytes at once where
+         * the section has enough bytes left; uleb128() handles the
+         * one byte case inline.
+         */
+        std::uint64_t uleb128_multibyte();
+
+        /**
+         * Skip over n consecutive LEB128s (signed or unsigned).  This
+         * counts terminating bytes 16 at a time, so skipping a run of
+         * LEB128s doesn't have to examine each one in turn.
+         */
+        void skip_leb128(size_t n = 1);
+
         taddr address()
         {
                 switch (sec->addr_size) {
@@ -244,9 +260,91 @@ struct abbrev_entry
         bool children;
         std::vector<attribute_spec> attributes;
 
+        // Computed information
+
+        // Offsets of the attributes from the end of the abbrev
+        // code, for as many leading attributes as have an offset
+        // that does not depend on the data (up to and including the
+        // first attribute with a variable-size form).  If every
+        // attribute has a fixed size, there is one more element,
+        // which is the size of all of them, and reading a DIE
+        // doesn't need to decode any of its attributes.
+        std::vector<section_offset> fixed_offsets;
+
+        // Index in attributes of each DW_AT below max_direct_attr,
+        // or no_slot.  Other attributes are looked up by scanning
+        // attributes.
+        static constexpr unsigned max_direct_attr = 0x80;
+        static constexpr std::uint8_t no_slot = 0xff;
+        std::array<std::uint8_t, max_direct_attr> slots;
+
         abbrev_entry() : code(0) { }
 
         bool read(cursor *cur);
+
+        /**
+         * Compute fixed_offsets and slots for a unit with the given
+         * address size and DWARF format.  Must be called after
+         * read().
+         */
+        void compute_layout(unsigned addr_size, format fmt);
+
+        /**
+         * Return the index in attributes of attr, or -1 if this
+         * abbrev does not have attr.
+         */
+        int find_attribute(DW_AT attr) const
+        {
+                if ((unsigned)attr < max_direct_attr) {
+                        std::uint8_t slot = slots[(unsigned)attr];
+                        if (slot != no_slot)
+                                return slot;
+                        // Attributes past no_slot don't have a slot
+                        // and are found by the scan below
+                        if (attributes.size() < no_slot)
+                                return -1;
+                }
+                for (size_t i = 0; i < attributes.size(); i++)
+                        if (attributes[i].name == attr)
+                                return i;
+                return -1;
+        }
+};
+
+/**
+ * An abbrev table in .debug_abbrev.  Units that refer to the same
+ * table with the same address size and format share one of these.
+ */
+struct abbrev_table
+{
+        // Map from abbrev code to abbrev.  If the map is dense, it
+        // will be stored in the vector; otherwise it will be stored
+        // in the map.
+        std::vector<abbrev_entry> vec;
+        std::unordered_map<abbrev_code, abbrev_entry> map;
+
+        /**
+         * Read the table starting at cur, computing the attribute
+         * layouts for units with the given address size and format.
+         */
+        void read(cursor *cur, unsigned addr_size, format fmt);
+
+        /**
+         * Return the abbrev with the given code, or nullptr if there
+         * is none.
+         */
+        const abbrev_entry *find(abbrev_code code) const
+        {
+                if (!vec.empty()) {
+                        if (code >= vec.size() || vec[code].code == 0)
+                                return nullptr;
+                        return &vec[code];
+                }
+                auto it = map.find(code);
+                if (it == map.end())
+                        return nullptr;
+                return &it->second;
+        }
 };
 
 /**
@@ -4,7 +4,9 @@
 
 #include "internal.hh"
 
+#include <algorithm>
 #include <cassert>
+#include <mutex>
 
 using namespace std;
 
@@ -40,18 +42,63 @@ struct line_table::impl
 
         // The offset in sec following the last read file name entry.
         // File name entries can appear both in the line table header
-        // and in the line number program itself.  Since we can
-        // iterate over the line number program repeatedly, this keeps
-        // track of how far we've gotten so we don't add the same
-        // entry twice.
+        // and in the line number program itself.  This keeps track
+        // of how far we've gotten so we don't add the same entry
+        // twice.
         section_offset last_file_name_end;
-        // If an iterator has traversed the entire program, then we
-        // know we've gathered all file names.
-        bool file_names_complete;
 
-        impl() : last_file_name_end(0), file_names_complete(false) {};
+        // The rows of the line table, decoded from the line number
+        // program on first use.  Each field is a separate array so
+        // that find_address only touches the addresses.
+        enum : ubyte {
+                IS_STMT = 1 << 0,
+                BASIC_BLOCK = 1 << 1,
+                END_SEQUENCE = 1 << 2,
+                PROLOGUE_END = 1 << 3,
+                EPILOGUE_BEGIN = 1 << 4,
+        };
+        vector<taddr> addresses;
+        vector<unsigned> lines;
+        vector<unsigned> file_indexes;
+        vector<unsigned> columns;
+        vector<ubyte> flags;
+        vector<unsigned> op_indexes;
+        vector<unsigned> isas;
+        vector<unsigned> discriminators;
+
+        // The non-empty sequences of the table, sorted by low
+        // address.  Rows [first, last) cover [low, high) and row last
+        // is the end_sequence entry.  Sequences can overlap (for
+        // example, functions discarded by the linker all start at
+        // address 0), so max_high is the highest high of this and all
+        // preceding sequences, which bounds how far back a lookup has
+        // to search.
+        struct sequence
+        {
+                taddr low, high, max_high;
+                size_t first, last;
+        };
+        vector<sequence> sequences;
+
+        // Decoding may be requested from several threads at once
+        std::once_flag decode_once;
+
+        impl() : last_file_name_end(0) {};
 
         bool read_file_entry(cursor *cur, bool in_header);
+
+        // Run the line number program and build the rows and the
+        // sequence index, unless that has been done already.
+        void decode();
+
+        void decode_rows();
+
+        // Process the next opcode against the state machine
+        // registers.  If the opcode "adds a row to the table", store
+        // the row and return true.
+        bool step(cursor *cur, entry *regs, entry *row);
+
+        void add_row(const entry &row);
 };
 
 line_table::line_table(const shared_ptr<section> &sec, section_offset offset,
@@ -104,7 +151,8 @@ line_table::line_table(const shared_ptr<section> &sec, section_offset offset,
         m->standard_opcode_lengths[0] = 0;
         for (unsigned i = 1; i < m->opcode_base; i++) {
                 ubyte length = cur.fixed<ubyte>();
-                if (length != opcode_lengths[i])
+                if (i < sizeof(opcode_lengths) / sizeof(opcode_lengths[0]) &&
+                    length != opcode_lengths[i])
                         // The spec never says what to do if the
                         // opcode length of a standard opcode doesn't
                         // match the header.  Do the safe thing.
@@ -150,7 +198,8 @@ line_table::begin() const
 {
         if (!valid())
                 return iterator(nullptr, 0);
-        return iterator(this, m->program_offset);
+        m->decode();
+        return iterator(this, 0);
 }
 
 line_table::iterator
@@ -158,45 +207,125 @@ line_table::end() const
 {
         if (!valid())
                 return iterator(nullptr, 0);
-        return iterator(this, m->sec->size());
+        m->decode();
+        return iterator(this, m->addresses.size());
 }
 
 line_table::iterator
 line_table::find_address(taddr addr) const
 {
-        iterator prev = begin(), e = end();
-        if (prev == e)
-                return prev;
-
-        iterator it = prev;
-        for (++it; it != e; prev = it++) {
-                if (prev->address <= addr && it->address > addr &&
-                    !prev->end_sequence)
-                        return prev;
+        if (!valid())
+                return end();
+        m->decode();
+
+        // Find the last sequence starting at or before addr, then
+        // walk back over any earlier sequences that could still
+        // overlap addr.
+        auto &seqs = m->sequences;
+        auto seq = upper_bound(seqs.begin(), seqs.end(), addr,
+                               [](taddr addr, const impl::sequence &s) {
+                                       return addr < s.low;
+                               });
+        while (seq != seqs.begin()) {
+                --seq;
+                if (addr < seq->high) {
+                        // The last row at or before addr.  The
+                        // first row is at seq->low, so this can't
+                        // run off the front of the sequence.
+                        auto first = m->addresses.begin() + seq->first;
+                        auto last = m->addresses.begin() + seq->last;
+                        auto row = upper_bound(first, last, addr) - 1;
+                        return iterator(this, row - m->addresses.begin());
+                }
+                if (seq->max_high <= addr)
+                        break;
         }
-        prev = e;
-        return prev;
+        return end();
 }
 
 const line_table::file *
 line_table::get_file(unsigned index) const
 {
-        if (index >= m->file_names.size()) {
-                // It could be declared in the line table program.
-                // This is unlikely, so we don't have to be
-                // super-efficient about this.  Just force our way
-                // through the whole line table program.
-                if (!m->file_names_complete) {
-                        for (auto &ent : *this)
-                                (void)ent;
+        // It could be declared in the line table program, and decoding
+        // it is also what makes file_names safe to read concurrently
+        m->decode();
+        if (index >= m->file_names.size())
+                throw out_of_range
+                        ("file name index " + std::to_string(index) +
+                         " exceeds file table size of " +
+                         std::to_string(m->file_names.size()));
+        return &m->file_names[index];
+}
+
+void
+line_table::impl::decode()
+{
+        call_once(decode_once, [this]() { decode_rows(); });
+}
+
+void
+line_table::impl::decode_rows()
+{
+        entry regs, row;
+        regs.reset(default_is_stmt);
+
+        // Execute the whole line number program, recording every row
+        // it emits
+        cursor cur(sec, program_offset);
+        bool pending = false;
+        while (!cur.end()) {
+                pending = true;
+                if (step(&cur, &regs, &row)) {
+                        add_row(row);
+                        pending = false;
                 }
-                if (index >= m->file_names.size())
-                        throw out_of_range
-                                ("file name index " + std::to_string(index) +
-                                 " exceeds file table size of " +
-                                 std::to_string(m->file_names.size()));
         }
-        return &m->file_names[index];
+        if (pending)
+                throw format_error("unexpected end of line table");
+
+        // Index the sequences by address
+        size_t first = 0;
+        for (size_t i = 0; i < addresses.size(); i++) {
+                if (!(flags[i] & END_SEQUENCE))
+                        continue;
+                if (addresses[first] < addresses[i])
+                        sequences.push_back(sequence{addresses[first],
+                                                addresses[i], 0, first, i});
+                first = i + 1;
+        }
+        sort(sequences.begin(), sequences.end(),
+             [](const sequence &a, const sequence &b) {
+                     return a.low < b.low;
+             });
+        taddr max_high = 0;
+        for (auto &seq : sequences) {
+                max_high = max(max_high, seq.high);
+                seq.max_high = max_high;
+        }
+}
+
+void
+line_table::impl::add_row(const entry &row)
+{
+        // File names can't be resolved to pointers until the program
+        // is fully decoded, since define_file may grow file_names
+        if (row.file_index >= file_names.size())
+                throw format_error("bad file index " +
+                                   std::to_string(row.file_index) +
+                                   " in line table");
+
+        addresses.push_back(row.address);
+        lines.push_back(row.line);
+        file_indexes.push_back(row.file_index);
+        columns.push_back(row.column);
+        flags.push_back((row.is_stmt ? IS_STMT : 0) |
+                        (row.basic_block ? BASIC_BLOCK : 0) |
+                        (row.end_sequence ? END_SEQUENCE : 0) |
+                        (row.prologue_end ? PROLOGUE_END : 0) |
+                        (row.epilogue_begin ? EPILOGUE_BEGIN : 0));
+        op_indexes.push_back(row.op_index);
+        isas.push_back(row.isa);
+        discriminators.push_back(row.discriminator);
 }
 
 bool
@@ -259,71 +388,66 @@ line_table::entry::get_description() const
         return res;
 }
 
-line_table::iterator::iterator(const line_table *table, section_offset pos)
-        : table(table), pos(pos)
+line_table::iterator::iterator(const line_table *table, size_t row)
+        : table(table), row(row)
 {
-        if (table) {
-                regs.reset(table->m->default_is_stmt);
-                ++(*this);
-        }
+        if (table)
+                load_row();
 }
 
 line_table::iterator &
 line_table::iterator::operator++()
 {
-        cursor cur(table->m->sec, pos);
-
-        // Execute opcodes until we reach the end of the stream or an
-        // opcode emits a line table row
-        bool stepped = false, output = false;
-        while (!cur.end() && !output) {
-                output = step(&cur);
-                stepped = true;
-        }
-        if (stepped && !output)
-                throw format_error("unexpected end of line table");
-        if (stepped && cur.end()) {
-                // Record that all file names must be known now
-                table->m->file_names_complete = true;
-        }
-        if (output) {
-                // Resolve file name of entry
-                if (entry.file_index < table->m->file_names.size())
-                        entry.file = &table->m->file_names[entry.file_index];
-                else
-                        throw format_error("bad file index " +
-                                           std::to_string(entry.file_index) +
-                                           " in line table");
-        }
-
-        pos = cur.get_section_offset();
+        ++row;
+        load_row();
         return *this;
 }
 
-bool
-line_table::iterator::step(cursor *cur)
+void
+line_table::iterator::load_row()
 {
-        struct line_table::impl *m = table->m.get();
+        const line_table::impl *m = table->m.get();
+        if (row >= m->addresses.size())
+                return;
+
+        ubyte flags = m->flags[row];
+        entry.address = m->addresses[row];
+        entry.op_index = m->op_indexes[row];
+        entry.file_index = m->file_indexes[row];
+        entry.file = &m->file_names[entry.file_index];
+        entry.line = m->lines[row];
+        entry.column = m->columns[row];
+        entry.is_stmt = flags & impl::IS_STMT;
+        entry.basic_block = flags & impl::BASIC_BLOCK;
+        entry.end_sequence = flags & impl::END_SEQUENCE;
+        entry.prologue_end = flags & impl::PROLOGUE_END;
+        entry.epilogue_begin = flags & impl::EPILOGUE_BEGIN;
+        entry.isa = m->isas[row];
+        entry.discriminator = m->discriminators[row];
+}
 
+bool
+line_table::impl::step(cursor *cur, entry *regs, entry *row)
+{
         // Read the opcode (DWARF4 section 6.2.3)
         ubyte opcode = cur->fixed<ubyte>();
-        if (opcode >= m->opcode_base) {
+        if (opcode >= opcode_base) {
                 // Special opcode (DWARF4 section 6.2.5.1)
-                ubyte adjusted_opcode = opcode - m->opcode_base;
-                unsigned op_advance = adjusted_opcode / m->line_range;
-                signed line_inc = m->line_base + (signed)adjusted_opcode % m->line_range;
-
-                regs.line += line_inc;
-                regs.address += m->minimum_instruction_length *
-                        ((regs.op_index + op_advance)
-                         / m->maximum_operations_per_instruction);
-                regs.op_index = (regs.op_index + op_advance)
-                        % m->maximum_operations_per_instruction;
-                entry = regs;
-
-                regs.basic_block = regs.prologue_end =
-                        regs.epilogue_begin = false;
-                regs.discriminator = 0;
+                ubyte adjusted_opcode = opcode - opcode_base;
+                unsigned op_advance = adjusted_opcode / line_range;
+                signed line_inc = line_base + (signed)adjusted_opcode % line_range;
+
+                regs->line += line_inc;
+                regs->address += minimum_instruction_length *
+                        ((regs->op_index + op_advance)
+                         / maximum_operations_per_instruction);
+                regs->op_index = (regs->op_index + op_advance)
+                        % maximum_operations_per_instruction;
+                *row = *regs;
+
+                regs->basic_block = regs->prologue_end =
+                        regs->epilogue_begin = false;
+                regs->discriminator = 0;
 
                 return true;
         } else if (opcode != 0) {
@@ -341,56 +465,59 @@ line_table::iterator::step(cursor *cur)
 #pragma GCC diagnostic warning "-Wswitch-enum"
                 switch ((DW_LNS)opcode) {
                 case DW_LNS::copy:
-                        entry = regs;
-                        regs.basic_block = regs.prologue_end =
-                                regs.epilogue_begin = false;
-                        regs.discriminator = 0;
+                        *row = *regs;
+                        regs->basic_block = regs->prologue_end =
+                                regs->epilogue_begin = false;
+                        regs->discriminator = 0;
                         break;
                 case DW_LNS::advance_pc:
                         // Opcode advance (as for special opcodes)
                         uarg = cur->uleb128();
                 advance_pc:
-                        regs.address += m->minimum_instruction_length *
-                                ((regs.op_index + uarg)
-                                 / m->maximum_operations_per_instruction);
-                        regs.op_index = (regs.op_index + uarg)
-                                % m->maximum_operations_per_instruction;
+                        regs->address += minimum_instruction_length *
+                                ((regs->op_index + uarg)
+                                 / maximum_operations_per_instruction);
+                        regs->op_index = (regs->op_index + uarg)
+                                % maximum_operations_per_instruction;
                         break;
                 case DW_LNS::advance_line:
-                        regs.line = (signed)regs.line + cur->sleb128();
+                        regs->line = (signed)regs->line + cur->sleb128();
                         break;
                 case DW_LNS::set_file:
-                        regs.file_index = cur->uleb128();
+                        regs->file_index = cur->uleb128();
                         break;
                 case DW_LNS::set_column:
-                        regs.column = cur->uleb128();
+                        regs->column = cur->uleb128();
                         break;
                 case DW_LNS::negate_stmt:
-                        regs.is_stmt = !regs.is_stmt;
+                        regs->is_stmt = !regs->is_stmt;
                         break;
                 case DW_LNS::set_basic_block:
-                        regs.basic_block = true;
+                        regs->basic_block = true;
                         break;
                 case DW_LNS::const_add_pc:
-                        uarg = (255 - m->opcode_base) / m->line_range;
+                        uarg = (255 - opcode_base) / line_range;
                         goto advance_pc;
                 case DW_LNS::fixed_advance_pc:
-                        regs.address += cur->fixed<uhalf>();
-                        regs.op_index = 0;
+                        regs->address += cur->fixed<uhalf>();
+                        regs->op_index = 0;
                         break;
                 case DW_LNS::set_prologue_end:
-                        regs.prologue_end = true;
+                        regs->prologue_end = true;
                         break;
                 case DW_LNS::set_epilogue_begin:
-                        regs.epilogue_begin = true;
+                        regs->epilogue_begin = true;
                         break;
                 case DW_LNS::set_isa:
-                        regs.isa = cur->uleb128();
+                        regs->isa = cur->uleb128();
                         break;
                 default:
-                        // XXX Vendor extensions
-                        throw format_error("unknown line number opcode " +
-                                           to_string((DW_LNS)opcode));
+                        // A vendor extension or an opcode from a
+                        // later version.  The header tells us how
+                        // many ULEB128 arguments it takes, so skip
+                        // them.
+                        cur->skip_leb128(standard_opcode_lengths[opcode]);
+                        break;
                 }
                 return ((DW_LNS)opcode == DW_LNS::copy);
         } else { // opcode == 0
@@ -401,20 +528,20 @@ line_table::iterator::step(cursor *cur)
                 opcode = cur->fixed<ubyte>();
                 switch ((DW_LNE)opcode) {
                 case DW_LNE::end_sequence:
-                        regs.end_sequence = true;
-                        entry = regs;
-                        regs.reset(m->default_is_stmt);
+                        regs->end_sequence = true;
+                        *row = *regs;
+                        regs->reset(default_is_stmt);
                         break;
                 case DW_LNE::set_address:
-                        regs.address = cur->address();
-                        regs.op_index = 0;
+                        regs->address = cur->address();
+                        regs->op_index = 0;
                         break;
                 case DW_LNE::define_file:
-                        m->read_file_entry(cur, false);
+                        read_file_entry(cur, false);
                         break;
                 case DW_LNE::set_discriminator:
                         // XXX Only DWARF4
-                        regs.discriminator = cur->uleb128();
+                        regs->discriminator = cur->uleb128();
                         break;
                 case DW_LNE::lo_user...DW_LNE::hi_user:
                         // XXX Vendor extensions
@@ -97,7 +97,7 @@ public:
                 T *src = base, *dest = (T*)newbuf;
                 for (; src < end; src++, dest++) {
                         new(dest) T(*src);
-                        dest->~T();
+                        src->~T();
                 }
                 if ((char*)base != buf)
                         delete[] (char*)base;
@@ -184,18 +184,7 @@ value::as_reference() const
 
         case DW_FORM::ref_addr: {
                 off = cur.offset();
-                // These seem to be extremely rare in practice (I
-                // haven't been able to get gcc to produce a
-                // ref_addr), so it's not worth caching this lookup.
-                const compilation_unit *base_cu = nullptr;
-                for (auto &file_cu : cu->get_dwarf().compilation_units()) {
-                        if (file_cu.get_section_offset() > off)
-                                break;
-                        base_cu = &file_cu;
-                }
-                die d(base_cu);
-                d.read(off - base_cu->get_section_offset());
-                return d;
+                return cu->get_dwarf().get_die(off);
         }
 
         case DW_FORM::ref_sig8: {
@@ -441,6 +441,41 @@ struct Phdr<Elf64, Order>
         }
 };
 
+// Note types of the "GNU" owner (from the GNU ABI; other owners
+// define their own types)
+enum class nt : ElfTypes::Word
+{
+        gnu_abi_tag      = 1,   // ABI the object was built for
+        gnu_hwcap        = 2,   // Synthetic hardware capabilities
+        gnu_build_id     = 3,   // Unique build ID bits
+        gnu_gold_version = 4,   // Version of the gold linker
+        gnu_property     = 5,   // Program property
+};
+
+std::string
+to_string(nt v);
+
+// Note header (ELF64 figure 9).  This is the same in ELF32 and ELF64,
+// except that ELF64 note sections may be 8-byte aligned.
+template<typename E = Elf64, byte_order Order = byte_order::native>
+struct Nhdr
+{
+        typedef E types;
+        static const byte_order order = Order;
+
+        typename E::Word namesz; // Length of the owner name, including the NUL
+        typename E::Word descsz; // Length of the descriptor
+        nt               type;   // Note type, interpreted by owner
+
+        template<typename E2>
+        void from(const E2 &o)
+        {
+                namesz = swizzle(o.namesz, o.order, order);
+                descsz = swizzle(o.descsz, o.order, order);
+                type   = swizzle(o.type, o.order, order);
+        }
+};
+
 // Symbol bindings (ELF32 figure 1-16, ELF64 table 14)
 enum class stb : unsigned char
 {
@@ -114,6 +114,16 @@ public:
          */
         const section &get_section(unsigned index) const;
 
+        /**
+         * Return the descriptor of the first note with the given
+         * owner name and type, looking in the note sections or, if
+         * there are none, the note segments.  Returns nullptr if
+         * there is no such note.  For example, the GNU build ID is
+         * get_note("GNU", nt::gnu_build_id, &size).
+         */
+        const void *get_note(const std::string &name, nt type,
+                             size_t *size_out) const;
+
 private:
         struct impl;
         std::shared_ptr<impl> m;
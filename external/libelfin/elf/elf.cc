@@ -153,6 +153,68 @@ elf::get_section(unsigned index) const
         return sections().at(index);
 }
 
+// Search the notes in data (ELF64 section 5.2 / gABI "Note
+// Section") for the first one with the given owner and type
+static const void *
+find_note(const elf &f, const char *data, size_t size, size_t align,
+          const string &name, nt type, size_t *size_out)
+{
+        auto &hdr = f.get_hdr();
+        align = align == 8 ? 8 : 4;
+        size_t pos = 0;
+        while (size - pos >= sizeof(Nhdr<>)) {
+                Nhdr<> nhdr{};
+                canon_hdr(&nhdr, data + pos, hdr.ei_class, hdr.ei_data);
+                size_t name_pos = pos + sizeof(Nhdr<>);
+                if (nhdr.namesz > size - name_pos)
+                        break;
+                size_t desc_pos = (name_pos + nhdr.namesz + align - 1) & ~(align - 1);
+                if (desc_pos > size || nhdr.descsz > size - desc_pos)
+                        break;
+                if (nhdr.type == type && nhdr.namesz == name.size() + 1 &&
+                    memcmp(data + name_pos, name.c_str(), nhdr.namesz) == 0) {
+                        *size_out = nhdr.descsz;
+                        return data + desc_pos;
+                }
+                pos = (desc_pos + nhdr.descsz + align - 1) & ~(align - 1);
+                if (pos > size)
+                        break;
+        }
+        return nullptr;
+}
+
+const void *
+elf::get_note(const std::string &name, nt type, size_t *size_out) const
+{
+        bool have_sections = false;
+        for (auto &sec : sections()) {
+                if (sec.get_hdr().type != sht::note)
+                        continue;
+                have_sections = true;
+                const void *desc = find_note(*this, (const char*)sec.data(),
+                                             sec.size(),
+                                             sec.get_hdr().addralign,
+                                             name, type, size_out);
+                if (desc)
+                        return desc;
+        }
+        if (have_sections)
+                return nullptr;
+
+        // Stripped files may only have the segments
+        for (auto &seg : segments()) {
+                if (seg.get_hdr().type != pt::note)
+                        continue;
+                const void *desc = find_note(*this, (const char*)seg.data(),
+                                             seg.file_size(),
+                                             seg.get_hdr().align,
+                                             name, type, size_out);
+                if (desc)
+                        return desc;
+        }
+        return nullptr;
+}
+
 const segment&
 elf::get_segment(unsigned index) const
 {
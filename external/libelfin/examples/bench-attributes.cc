@@ -0,0 +1,92 @@
+// Benchmark for visiting every attribute of every DIE in a file,
+// comparing die::attributes(), which builds a vector per DIE, with
+// die::attributes_view(), which doesn't allocate.
+
+#include "elf++.hh"
+#include "dwarf++.hh"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+
+using namespace std;
+
+// Mix in something from each attribute so the walk can't be elided
+static uint64_t
+touch(dwarf::DW_AT name, const dwarf::value &val)
+{
+        return (uint64_t)name * 31 + (uint64_t)val.get_type();
+}
+
+static uint64_t
+walk_vector(const dwarf::die &node)
+{
+        uint64_t sum = 0;
+        for (auto &attr : node.attributes())
+                sum += touch(attr.first, attr.second);
+        for (auto &child : node)
+                sum += walk_vector(child);
+        return sum;
+}
+
+static uint64_t
+walk_view(const dwarf::die &node)
+{
+        uint64_t sum = 0;
+        for (auto &attr : node.attributes_view())
+                sum += touch(attr.first, attr.second);
+        for (auto &child : node)
+                sum += walk_view(child);
+        return sum;
+}
+
+template<typename F>
+static double
+time_ms(const dwarf::dwarf &dw, F walk, uint64_t *sum)
+{
+        auto start = chrono::steady_clock::now();
+        *sum = 0;
+        for (auto &cu : dw.compilation_units())
+                *sum += walk(cu.root());
+        chrono::duration<double, milli> elapsed =
+                chrono::steady_clock::now() - start;
+        return elapsed.count();
+}
+
+int
+main(int argc, char **argv)
+{
+        if (argc != 2) {
+                fprintf(stderr, "usage: %s elf-file\n", argv[0]);
+                return 2;
+        }
+
+        int fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+                return 1;
+        }
+
+        elf::elf ef(elf::create_mmap_loader(fd));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef));
+
+        // Warm up the abbrev tables and sibling caches
+        uint64_t sum;
+        time_ms(dw, walk_view, &sum);
+
+        for (int pass = 1; pass <= 3; pass++) {
+                uint64_t vector_sum, view_sum;
+                double vector_ms = time_ms(dw, walk_vector, &vector_sum);
+                double view_ms = time_ms(dw, walk_view, &view_sum);
+                if (vector_sum != view_sum) {
+                        fprintf(stderr, "attribute walks disagree\n");
+                        return 1;
+                }
+                printf("pass %d: attributes() %8.2f ms, "
+                       "attributes_view() %8.2f ms\n",
+                       pass, vector_ms, view_ms);
+        }
+        return 0;
+}
@@ -0,0 +1,186 @@
+// Benchmark for LEB128 decoding and skipping on the LEB128s of a real
+// .debug_info section, comparing dwarf::cursor against the
+// byte-at-a-time loops it used to use.  This exercises internal
+// interfaces, so it includes internal.hh.
+
+#include "elf++.hh"
+#include "dwarf++.hh"
+#include "internal.hh"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <string.h>
+
+using namespace std;
+
+// The LEB128s of a .debug_info section, back to back
+struct leb128_stream
+{
+        string bytes;
+        vector<bool> is_signed;
+        uint64_t lengths[11];
+};
+
+static void
+collect(const dwarf::compilation_unit &cu, leb128_stream *out)
+{
+        auto add = [&](const char *start, const char *end, bool is_signed) {
+                out->bytes.append(start, end - start);
+                out->is_signed.push_back(is_signed);
+                out->lengths[min<size_t>(end - start, 10)]++;
+        };
+
+        dwarf::cursor cur(cu.data(), cu.root().get_unit_offset());
+        while (cur.pos < cur.sec->end) {
+                const char *start = cur.pos;
+                dwarf::abbrev_code acode = cur.uleb128();
+                add(start, cur.pos, false);
+                if (acode == 0)
+                        continue;
+                for (auto &attr : cu.get_abbrev(acode).attributes) {
+                        start = cur.pos;
+                        switch (attr.form) {
+                        case dwarf::DW_FORM::udata:
+                        case dwarf::DW_FORM::ref_udata:
+                                cur.uleb128();
+                                add(start, cur.pos, false);
+                                break;
+                        case dwarf::DW_FORM::sdata:
+                                cur.sleb128();
+                                add(start, cur.pos, true);
+                                break;
+                        case dwarf::DW_FORM::block:
+                        case dwarf::DW_FORM::exprloc: {
+                                uint64_t size = cur.uleb128();
+                                add(start, cur.pos, false);
+                                cur += size;
+                                break;
+                        }
+                        default:
+                                cur.skip_form(attr.form);
+                        }
+                }
+        }
+}
+
+// The loops cursor used before it decoded a window at a time
+static uint64_t
+bytewise_uleb128(const char **pos, const char *end)
+{
+        uint64_t result = 0;
+        int shift = 0;
+        while (*pos < end) {
+                uint8_t byte = *(uint8_t*)((*pos)++);
+                result |= (uint64_t)(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                        return result;
+                shift += 7;
+        }
+        throw underflow_error("cannot read past end of DWARF section");
+}
+
+static int64_t
+bytewise_sleb128(const char **pos, const char *end)
+{
+        uint64_t result = 0;
+        unsigned shift = 0;
+        while (*pos < end) {
+                uint8_t byte = *(uint8_t*)((*pos)++);
+                result |= (uint64_t)(byte & 0x7f) << shift;
+                shift += 7;
+                if ((byte & 0x80) == 0) {
+                        if (shift < sizeof(result)*8 && (byte & 0x40))
+                                result |= -((uint64_t)1 << shift);
+                        return result;
+                }
+        }
+        throw underflow_error("cannot read past end of DWARF section");
+}
+
+template<typename F>
+static double
+time_ms(int reps, F f)
+{
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < reps; i++)
+                f();
+        chrono::duration<double, milli> elapsed =
+                chrono::steady_clock::now() - start;
+        return elapsed.count();
+}
+
+int
+main(int argc, char **argv)
+{
+        if (argc < 2 || argc > 3) {
+                fprintf(stderr, "usage: %s elf-file [reps]\n", argv[0]);
+                return 2;
+        }
+        int reps = argc > 2 ? atoi(argv[2]) : 20;
+
+        int fd = open(argv[1], O_RDONLY);
+        if (fd < 0) {
+                fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+                return 1;
+        }
+
+        elf::elf ef(elf::create_mmap_loader(fd));
+        dwarf::dwarf dw(dwarf::elf::create_loader(ef));
+
+        leb128_stream stream = {};
+        for (auto &cu : dw.compilation_units())
+                collect(cu, &stream);
+        size_t count = stream.is_signed.size();
+        printf("%zu LEB128s, %zu bytes; by length:", count,
+               stream.bytes.size());
+        for (int len = 1; len <= 10; len++)
+                if (stream.lengths[len])
+                        printf(" %d:%" PRIu64, len, stream.lengths[len]);
+        printf("\n");
+
+        auto sec = make_shared<dwarf::section>(
+                dwarf::section_type::info, stream.bytes.data(),
+                stream.bytes.size(), dwarf::byte_order::lsb);
+        const char *end = sec->end;
+        volatile uint64_t sink;
+
+        double old_decode = time_ms(reps, [&]() {
+                uint64_t sum = 0;
+                const char *pos = sec->begin;
+                for (size_t i = 0; i < count; i++)
+                        sum += stream.is_signed[i] ? bytewise_sleb128(&pos, end)
+                                : bytewise_uleb128(&pos, end);
+                sink = sum;
+        });
+        double new_decode = time_ms(reps, [&]() {
+                uint64_t sum = 0;
+                dwarf::cursor cur(sec);
+                for (size_t i = 0; i < count; i++)
+                        sum += stream.is_signed[i] ? cur.sleb128()
+                                : cur.uleb128();
+                sink = sum;
+        });
+        double old_skip = time_ms(reps, [&]() {
+                const char *pos = sec->begin;
+                for (size_t i = 0; i < count; i++) {
+                        while (pos < end && (*(uint8_t*)pos & 0x80))
+                                pos++;
+                        pos++;
+                }
+                sink = pos - sec->begin;
+        });
+        double new_skip = time_ms(reps, [&]() {
+                dwarf::cursor cur(sec);
+                cur.skip_leb128(count);
+                sink = cur.pos - sec->begin;
+        });
+        (void)sink;
+
+        printf("decode: byte loop %8.2f ms, cursor %8.2f ms\n",
+               old_decode, new_decode);
+        printf("skip:   byte loop %8.2f ms, cursor %8.2f ms\n",
+               old_skip, new_skip);
+        return 0;
+}
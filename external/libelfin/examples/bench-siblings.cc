@@ -0,0 +1,136 @@
+// Benchmark for DIE tree traversal on a synthetic compilation unit
+// with deeply nested DIEs that have no DW_AT_sibling, where stepping
+// over a DIE means finding the end of its subtree.
+
+#include "dwarf++.hh"
+
+#include <chrono>
+#include <cstdlib>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string>
+
+using namespace std;
+
+// Serves .debug_info and .debug_abbrev from memory
+class synthetic_loader : public dwarf::loader
+{
+public:
+        string info, abbrev;
+
+        const void *load(dwarf::section_type section, size_t *size_out)
+        {
+                const string *data;
+                if (section == dwarf::section_type::info)
+                        data = &info;
+                else if (section == dwarf::section_type::abbrev)
+                        data = &abbrev;
+                else
+                        return nullptr;
+                *size_out = data->size();
+                return data->data();
+        }
+};
+
+static void
+uleb128(string *out, uint64_t val)
+{
+        do {
+                uint8_t byte = val & 0x7f;
+                val >>= 7;
+                if (val)
+                        byte |= 0x80;
+                out->push_back(byte);
+        } while (val);
+}
+
+static void
+fixed(string *out, uint64_t val, int size)
+{
+        for (int i = 0; i < size; i++)
+                out->push_back((val >> (8 * i)) & 0xff);
+}
+
+enum { CU = 1, SCOPE = 2, LEAF = 3 };
+
+// A DWARF 4 unit whose root holds depth nested lexical blocks, each
+// with width leaf variables before the next block
+static shared_ptr<synthetic_loader>
+make_unit(unsigned depth, unsigned width)
+{
+        auto l = make_shared<synthetic_loader>();
+
+        string &ab = l->abbrev;
+        auto add_abbrev = [&](int code, dwarf::DW_TAG tag, bool children) {
+                uleb128(&ab, code);
+                uleb128(&ab, (uint64_t)tag);
+                ab.push_back(children ? 1 : 0);
+                uleb128(&ab, (uint64_t)dwarf::DW_AT::name);
+                uleb128(&ab, (uint64_t)dwarf::DW_FORM::string);
+                fixed(&ab, 0, 2);
+        };
+        add_abbrev(CU, dwarf::DW_TAG::compile_unit, true);
+        add_abbrev(SCOPE, dwarf::DW_TAG::lexical_block, true);
+        add_abbrev(LEAF, dwarf::DW_TAG::variable, false);
+        ab.push_back(0);
+
+        string dies;
+        auto add_die = [&](int code, const string &name) {
+                uleb128(&dies, code);
+                dies += name;
+                dies.push_back(0);
+        };
+        add_die(CU, "synthetic.c");
+        for (unsigned d = 0; d < depth; d++) {
+                for (unsigned w = 0; w < width; w++)
+                        add_die(LEAF, "v" + to_string(w));
+                add_die(SCOPE, "b" + to_string(d));
+        }
+        // Terminate the innermost block and every block around it,
+        // then the root's children
+        for (unsigned d = 0; d <= depth; d++)
+                dies.push_back(0);
+
+        string &info = l->info;
+        // unit_length, version, debug_abbrev_offset, address_size
+        fixed(&info, 2 + 4 + 1 + dies.size(), 4);
+        fixed(&info, 4, 2);
+        fixed(&info, 0, 4);
+        info.push_back(8);
+        info += dies;
+        return l;
+}
+
+static uint64_t
+walk(const dwarf::die &node)
+{
+        uint64_t n = 1;
+        for (auto &child : node)
+                n += walk(child);
+        return n;
+}
+
+int
+main(int argc, char **argv)
+{
+        unsigned depth = argc > 1 ? atoi(argv[1]) : 2000;
+        unsigned width = argc > 2 ? atoi(argv[2]) : 4;
+        if (argc > 3 || depth == 0) {
+                fprintf(stderr, "usage: %s [depth [width]]\n", argv[0]);
+                return 2;
+        }
+
+        dwarf::dwarf dw(make_unit(depth, width));
+        const dwarf::compilation_unit &cu = dw.compilation_units()[0];
+        printf("%u nested blocks, %u leaves each\n", depth, width);
+
+        for (int pass = 1; pass <= 3; pass++) {
+                auto start = chrono::steady_clock::now();
+                uint64_t n = walk(cu.root());
+                chrono::duration<double, milli> elapsed =
+                        chrono::steady_clock::now() - start;
+                printf("pass %d: %" PRIu64 " DIEs in %.2f ms\n",
+                       pass, n, elapsed.count());
+        }
+        return 0;
+}
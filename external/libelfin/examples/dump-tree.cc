@@ -13,7 +13,7 @@ dump_tree(const dwarf::die &node, int depth = 0)
         printf("%*.s<%" PRIx64 "> %s\n", depth, "",
                node.get_section_offset(),
                to_string(node.tag).c_str());
-        for (auto &attr : node.attributes())
+        for (auto &attr : node.attributes_view())
                 printf("%*.s      %s %s\n", depth, "",
                        to_string(attr.first).c_str(),
                        to_string(attr.second).c_str());
@@ -50,7 +50,7 @@ dump_die(const dwarf::die &node)
         printf("<%" PRIx64 "> %s\n",
                node.get_section_offset(),
                to_string(node.tag).c_str());
-        for (auto &attr : node.attributes())
+        for (auto &attr : node.attributes_view())
                 printf("      %s %s\n",
                        to_string(attr.first).c_str(),
                        to_string(attr.second).c_str());
@@ -81,32 +81,33 @@ main(int argc, char **argv)
         dwarf::dwarf dw(dwarf::elf::create_loader(ef));
 
         // Find the CU containing pc
-        // XXX Use .debug_aranges
-        for (auto &cu : dw.compilation_units()) {
-                if (die_pc_range(cu.root()).contains(pc)) {
-                        // Map PC to a line
-                        auto &lt = cu.get_line_table();
-                        auto it = lt.find_address(pc);
-                        if (it == lt.end())
-                                printf("UNKNOWN\n");
-                        else
-                                printf("%s\n",
-                                       it->get_description().c_str());
+        const dwarf::compilation_unit *cu;
+        try {
+                cu = &dw.get_compilation_unit(pc);
+        } catch (out_of_range &e) {
+                return 0;
+        }
 
-                        // Map PC to an object
-                        // XXX Index/helper/something for looking up PCs
-                        // XXX DW_AT_specification and DW_AT_abstract_origin
-                        vector<dwarf::die> stack;
-                        if (find_pc(cu.root(), pc, &stack)) {
-                                bool first = true;
-                                for (auto &d : stack) {
-                                        if (!first)
-                                                printf("\nInlined in:\n");
-                                        first = false;
-                                        dump_die(d);
-                                }
-                        }
-                        break;
+        // Map PC to a line
+        auto &lt = cu->get_line_table();
+        auto it = lt.find_address(pc);
+        if (it == lt.end())
+                printf("UNKNOWN\n");
+        else
+                printf("%s\n",
+                       it->get_description().c_str());
+
+        // Map PC to an object
+        // XXX Index/helper/something for looking up PCs
+        // XXX DW_AT_specification and DW_AT_abstract_origin
+        vector<dwarf::die> stack;
+        if (find_pc(cu->root(), pc, &stack)) {
+                bool first = true;
+                for (auto &d : stack) {
+                        if (!first)
+                                printf("\nInlined in:\n");
+                        first = false;
+                        dump_die(d);
                 }
         }
 
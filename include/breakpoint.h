@@ -1,5 +1,6 @@
 #include <fcntl.h>
 #include <cstdint>
+#include "target_memory.h"
 
 #ifndef DEBUGGER_BREAKPOINT_H
 #define DEBUGGER_BREAKPOINT_H
@@ -8,7 +9,7 @@
 class breakpoint {
 public:
     breakpoint() = default;
-    breakpoint(pid_t pid, std::intptr_t addr);
+    breakpoint(target_memory &memory, std::intptr_t addr);
 
     void enable();
 
@@ -16,12 +17,16 @@ public:
 
     [[nodiscard]] auto is_enabled() const -> bool;
     [[nodiscard]] auto get_address() const -> std::intptr_t;
+    [[nodiscard]] auto get_saved_data() const -> uint8_t;
 
 private:
-    pid_t m_pid;
-    std::intptr_t m_addr;
-    bool m_enabled;
-    uint8_t m_saved_data; // data which used to be at the breakpoint address
+    // patches the saved data of whole batches of breakpoints at once
+    friend class breakpoint_table;
+
+    target_memory *m_memory{};
+    std::intptr_t m_addr{};
+    bool m_enabled{};
+    uint8_t m_saved_data{}; // data which used to be at the breakpoint address
 };
 
 
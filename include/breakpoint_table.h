@@ -0,0 +1,68 @@
+#ifndef DEBUGGER_BREAKPOINT_TABLE_H
+#define DEBUGGER_BREAKPOINT_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "breakpoint.h"
+#include "target_memory.h"
+
+// Flat open-addressing table of the breakpoints keyed by address. Slots live
+// in a single array and are probed linearly, so lookups on every stop stay
+// within a cache line or two and inserting a breakpoint does not allocate.
+//
+// The batch operations are meant for the temporary breakpoints of `next`:
+// the addresses are grouped by aligned 8-byte word and every run of adjacent
+// words is patched with a single memory write.
+class breakpoint_table {
+public:
+    explicit breakpoint_table(target_memory &memory);
+
+    [[nodiscard]] auto contains(std::intptr_t addr) const -> bool;
+
+    // nullptr when there is no breakpoint at addr
+    auto find(std::intptr_t addr) -> breakpoint *;
+
+    // adds an enabled breakpoint at addr, an existing one is returned as is.
+    // Nothing is added when the int3 can't be written.
+    auto insert(std::intptr_t addr) -> breakpoint &;
+
+    void erase(std::intptr_t addr);
+
+    // enables breakpoints at every address not in the table yet and returns
+    // the addresses which were actually added. When one of them can't be
+    // written none are added and std::runtime_error is thrown.
+    auto insert_batch(std::vector<std::intptr_t> addrs) -> std::vector<std::intptr_t>;
+
+    // disables and removes the breakpoints at addrs, unknown addresses are ignored
+    void erase_batch(const std::vector<std::intptr_t> &addrs);
+
+    [[nodiscard]] auto size() const -> std::size_t;
+
+private:
+    enum class slot_state : uint8_t {
+        empty, used, deleted
+    };
+
+    struct slot {
+        std::intptr_t addr{};
+        slot_state state{slot_state::empty};
+        breakpoint bp{};
+    };
+
+    [[nodiscard]] auto index_of(std::intptr_t addr) const -> std::size_t;
+
+    auto claim(std::intptr_t addr) -> slot &;
+
+    void grow();
+
+    void patch(std::vector<std::intptr_t> addrs, bool arm);
+
+    target_memory *m_memory;
+    std::vector<slot> m_slots;
+    std::size_t m_size{}; // live entries
+    std::size_t m_used{}; // live entries plus tombstones
+};
+
+
+#endif //DEBUGGER_BREAKPOINT_TABLE_H
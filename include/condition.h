@@ -0,0 +1,67 @@
+#ifndef DEBUGGER_CONDITION_H
+#define DEBUGGER_CONDITION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+#include "registers.h"
+#include "target_memory.h"
+
+// where a variable named in a condition lives: base register plus offset,
+// or an absolute address when there is no base register
+struct condition_variable {
+    std::optional<reg> base;
+    int64_t offset;
+    std::size_t size;
+    bool is_signed;
+};
+
+enum class cond_op : uint8_t {
+    push_const,
+    push_reg,
+    load,      // operand: size | signed << 8
+    add, sub, mul, div, mod,
+    band, bor, bxor, shl, shr,
+    eq, ne, lt, le, gt, ge,
+    lnot, neg, bnot,
+    to_bool,
+    jump_false, // && short circuit: leaves 0 and jumps if the top is zero, pops otherwise
+    jump_true,  // || short circuit: leaves 1 and jumps if the top is non-zero, pops otherwise
+};
+
+struct cond_insn {
+    cond_op op;
+    uint64_t operand;
+};
+
+// A breakpoint condition compiled once into a small stack bytecode, so a hit
+// only costs reading the cached register file and the memory pages which the
+// expression touches.
+//
+// The syntax is the C expression subset over integers: literals, $register,
+// variable names, unary * (8-byte load), ! - ~, the binary arithmetic,
+// bitwise, comparison and logical operators, and parentheses.
+class condition {
+public:
+    using resolver = std::function<std::optional<condition_variable>(const std::string &name)>;
+
+    static constexpr std::size_t max_stack = 32;
+
+    // throws std::invalid_argument if the expression does not parse or names
+    // an unknown variable
+    condition(std::string text, const resolver &resolve);
+
+    [[nodiscard]] auto evaluate(register_cache &regs, target_memory &memory) const -> uint64_t;
+
+    [[nodiscard]] auto text() const -> const std::string &;
+
+private:
+    std::string m_text;
+    std::vector<cond_insn> m_code;
+};
+
+
+#endif //DEBUGGER_CONDITION_H
@@ -4,9 +4,28 @@
 #include "../external/libelfin/dwarf/dwarf++.hh"
 #include "../external/libelfin/elf/elf++.hh"
 #include <vector>
+#include <chrono>
+#include <memory>
+#include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <bits/types/siginfo_t.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
 #include "breakpoint.h"
+#include "breakpoint_table.h"
+#include "condition.h"
+#include "function_index.h"
+#include "index_cache.h"
+#include "line_index.h"
+#include "pc_index.h"
+#include "thread_pool.h"
+#include "tracepoints.h"
+#include "target_memory.h"
+#include "type_index.h"
+#include "registers.h"
+#include "watchpoint.h"
+#include "x86_decoder.h"
 
 #define DEBUGGER_DEBUGGER_H
 
@@ -25,19 +44,35 @@ struct symbol {
     std::uintptr_t addr;
 };
 
+// condition of a breakpoint and how much evaluating it costs
+struct breakpoint_condition {
+    condition cond;
+    uint64_t hits{};  // traps at the breakpoint, each one evaluates the condition
+    uint64_t stops{}; // hits where the condition held
+    std::chrono::nanoseconds eval_time{};
+};
+
 class debugger {
 public:
-    debugger(std::string prog_name, pid_t pid) : m_prog_name{std::move(prog_name)}, m_pid{pid} {
+    debugger(std::string prog_name, pid_t pid) : m_prog_name{std::move(prog_name)}, m_pid{pid}, m_memory{pid}, m_watchpoints{pid},
+                                                m_breakpoints{m_memory} {
         auto fd = open(m_prog_name.c_str(), O_RDONLY);
+        struct stat st{};
+        fstat(fd, &st);
+        m_image_size = static_cast<std::size_t>(st.st_size);
 
         m_elf = elf::elf{elf::create_mmap_loader(fd)};
         m_dwarf = dwarf::dwarf{dwarf::elf::create_loader(m_elf)};
+
+        build_indexes();
     };
 
     siginfo_t get_signal_info();
 
     void handle_command(const std::string &line);
 
+    void handle_signal(siginfo_t info);
+
     void handle_sigtrap(siginfo_t info);
 
     std::vector<std::string> split(const std::string &s, char delimiter);
@@ -46,12 +81,31 @@ public:
 
     void set_breakpoint_at_address(std::intptr_t addr);
 
-    void set_breakpoint_at_function(const std::string &name);
+    // both return the addresses of the breakpoints which were set
+    std::vector<std::intptr_t> set_breakpoint_at_function(const std::string &name);
+
+    std::vector<std::intptr_t> set_breakpoint_at_source_line(const std::string &file, unsigned line);
+
+    void set_breakpoint_condition(std::intptr_t addr, const std::string &expr);
+
+    std::vector<std::intptr_t> find_function_addresses(const std::string &name);
+
+    std::vector<std::intptr_t> find_source_line_addresses(const std::string &file, unsigned line);
 
-    void set_breakpoint_at_source_line(const std::string &file, unsigned line);
+    std::vector<std::intptr_t> find_location_addresses(const std::string &location);
+
+    void set_tracepoint(const std::string &location, const std::vector<std::string> &vars);
+
+    void remove_tracepoint(std::intptr_t addr);
+
+    void dump_breakpoint_conditions();
 
     std::vector<symbol> lookup_symbol(const std::string &name);
 
+    // layout of the type with this qualified name, or of the type of this
+    // variable
+    void print_type(const std::string &name);
+
     void step_over_breakpoint();
 
     void step_over();
@@ -62,6 +116,10 @@ public:
 
     void remove_breakpoint(std::intptr_t addr);
 
+    void set_watchpoint(std::intptr_t addr, std::size_t len, watch_kind kind);
+
+    void remove_watchpoint(std::intptr_t addr);
+
     void single_step_instruction();
 
     void single_step_instruction_with_breakpoint_check();
@@ -78,8 +136,14 @@ public:
 
     uint64_t read_memory(uint64_t address);
 
+    void read_memory(uint64_t address, void *buffer, std::size_t length);
+
+    void dump_memory(uint64_t address, std::size_t length);
+
     void write_memory(uint64_t address, uint64_t value);
 
+    void write_memory(uint64_t address, const void *buffer, std::size_t length);
+
     uint64_t get_pc();
 
     void set_pc(uint64_t pc);
@@ -91,10 +155,49 @@ private:
     pid_t m_pid;
     dwarf::dwarf m_dwarf;
     elf::elf m_elf;
+    std::size_t m_image_size{};
+    target_memory m_memory;
+    std::unordered_map<pid_t, register_cache> m_registers;
+    hw_watchpoints m_watchpoints;
 
     void continue_execution();
 
-    std::unordered_map<std::intptr_t, breakpoint> m_breakpoints;
+    register_cache &registers(pid_t tid);
+
+    register_cache &registers();
+
+    void resume(__ptrace_request request);
+
+    bool displaced_step(const breakpoint &bp);
+
+    // the tracepoint whose jmp covers addr, breakpoints can't go there
+    std::optional<std::intptr_t> patched_by_tracepoint(std::intptr_t addr);
+
+    std::optional<condition_variable> resolve_variable(uint64_t pc, const std::string &name);
+
+    std::optional<dwarf::die> lookup_variable(uint64_t pc, const std::string &name);
+
+    bool should_stop_at(std::intptr_t addr);
+
+    void build_indexes();
+
+    bool load_cached_indexes(const std::string &path, std::string_view build_id, std::string_view image);
+
+    // the indexes use the mapped cache in place when they were loaded from it
+    std::unique_ptr<index_cache::reader> m_index_cache;
+    pc_index m_pc_index;
+    line_index m_line_index;
+    function_index m_function_index;
+    type_index m_type_index;
+
+    std::unordered_map<std::intptr_t, breakpoint_condition> m_conditions;
+    // set when a breakpoint was hit but its condition did not hold
+    bool m_resume_after_stop{};
+
+    // started on the first tracepoint, when the tracee runs the agent
+    std::unique_ptr<trace_agent> m_agent;
+
+    breakpoint_table m_breakpoints;
 };
 
 
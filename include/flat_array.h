@@ -0,0 +1,120 @@
+#ifndef DEBUGGER_FLAT_ARRAY_H
+#define DEBUGGER_FLAT_ARRAY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Read-only array which either owns its elements or views memory owned by
+// someone else, such as an index cache mapped from disk. The indexes keep
+// their finalized tables in these, so a table loaded from the cache is used
+// in place without being copied or parsed.
+template <typename T>
+class flat_array {
+public:
+    flat_array() = default;
+
+    explicit flat_array(std::vector<T> owned) : m_owned{std::move(owned)}, m_view{m_owned} {
+    }
+
+    explicit flat_array(std::span<const T> mapped) : m_view{mapped} {
+    }
+
+    // moving a vector keeps its buffer, so the view stays valid
+    flat_array(flat_array &&) noexcept = default;
+
+    flat_array &operator=(flat_array &&) noexcept = default;
+
+    flat_array(const flat_array &) = delete;
+
+    flat_array &operator=(const flat_array &) = delete;
+
+    [[nodiscard]] auto size() const -> std::size_t {
+        return m_view.size();
+    }
+
+    [[nodiscard]] auto empty() const -> bool {
+        return m_view.empty();
+    }
+
+    auto operator[](std::size_t i) const -> const T & {
+        return m_view[i];
+    }
+
+    [[nodiscard]] auto begin() const {
+        return m_view.begin();
+    }
+
+    [[nodiscard]] auto end() const {
+        return m_view.end();
+    }
+
+    [[nodiscard]] auto span() const -> std::span<const T> {
+        return m_view;
+    }
+
+private:
+    std::vector<T> m_owned{};
+    std::span<const T> m_view{};
+};
+
+// FNV-1a, the keys are short names and paths
+inline auto hash_string(std::string_view s) -> uint64_t {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (auto c: s) {
+        h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Open addressing hash table from string keys to groups 0..n-1, stored as a
+// plain array of group numbers so it can be kept in a flat_array. key(g)
+// returns the key of group g, the keys are not stored in the table.
+namespace string_slots {
+    constexpr uint32_t empty = UINT32_MAX;
+
+    template <typename Key>
+    auto build(uint32_t n_groups, Key key) -> std::vector<uint32_t> {
+        // at most half full, so probes stay short
+        std::size_t capacity = 8;
+        while (capacity < 2 * static_cast<std::size_t>(n_groups)) {
+            capacity *= 2;
+        }
+        std::vector<uint32_t> slots(capacity, empty);
+        for (uint32_t g = 0; g < n_groups; ++g) {
+            auto i = hash_string(key(g)) & (capacity - 1);
+            while (slots[i] != empty) {
+                i = (i + 1) & (capacity - 1);
+            }
+            slots[i] = g;
+        }
+        return slots;
+    }
+
+    template <typename Key>
+    auto find(std::span<const uint32_t> slots, std::string_view wanted, Key key) -> std::optional<uint32_t> {
+        if (slots.empty()) {
+            return std::nullopt;
+        }
+        auto mask = slots.size() - 1;
+        auto i = hash_string(wanted) & mask;
+        // build() leaves half the slots empty, but a corrupt cache may not,
+        // so a miss gives up after visiting every slot once
+        for (std::size_t probes = 0; probes < slots.size(); ++probes, i = (i + 1) & mask) {
+            if (slots[i] == empty) {
+                return std::nullopt;
+            }
+            if (key(slots[i]) == wanted) {
+                return slots[i];
+            }
+        }
+        return std::nullopt;
+    }
+}
+
+
+#endif //DEBUGGER_FLAT_ARRAY_H
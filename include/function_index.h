@@ -0,0 +1,112 @@
+#ifndef DEBUGGER_FUNCTION_INDEX_H
+#define DEBUGGER_FUNCTION_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../external/libelfin/dwarf/dwarf++.hh"
+#include "flat_array.h"
+#include "index_cache.h"
+
+// name -> entry address lookup table over the subprograms with code. Names
+// point into .debug_str (or .debug_info for inline strings) instead of being
+// copied, the enclosing namespaces and classes are kept as a chain of scopes
+// shared by all functions in them. Definitions which take their name from a
+// declaration or an abstract instance (out of line member functions, out of
+// line copies of inline functions) are resolved once all units are added.
+// Once finalized, names are kept as offsets into the mapped ELF image, so the
+// tables can be saved to and used from the index cache.
+class function_index {
+public:
+    // collects the functions of one unit, call finalize() once all are added
+    void add_unit(const dwarf::compilation_unit &cu);
+
+    // takes over the functions collected by a shard built on another thread,
+    // names referring to other units are resolved by finalize()
+    void merge(function_index &&shard);
+
+    // image is the whole ELF file as mapped by its loader, which all names
+    // point into
+    void finalize(std::string_view image);
+
+    // writes the finalized tables to the cache
+    void save(index_cache::writer &out) const;
+
+    // uses the tables saved in the cache in place, instead of add_unit() and
+    // finalize(). Throws index_cache::format_error.
+    void load(index_cache::reader &in, std::string_view image);
+
+    // sorted addresses past the prologue of every function with this name. A
+    // qualified name has to match the innermost scopes, "add", "ns::add" and
+    // "outer::ns::add" all find outer::ns::add. Template functions are also
+    // found by their name without the template arguments.
+    [[nodiscard]] auto find(const std::string &name) const -> std::vector<uint64_t>;
+
+    [[nodiscard]] auto empty() const -> bool;
+
+private:
+    static constexpr uint32_t no_scope = UINT32_MAX;
+
+    struct scope {
+        const char *name;
+        uint32_t parent;
+    };
+
+    // a subprogram which names a function, or which refers to another one
+    // for its name when name is null
+    struct origin {
+        const char *name;
+        uint32_t scope;
+        dwarf::section_offset next;
+    };
+
+    struct function {
+        std::string_view name;
+        uint32_t scope;
+        uint64_t entry;
+    };
+
+    // a definition whose name is found by following origin
+    struct deferred {
+        dwarf::section_offset origin;
+        uint64_t entry;
+    };
+
+    void add_dies(const dwarf::die &parent, uint32_t scope, const dwarf::line_table &lt);
+
+    void add_function(const char *name, uint32_t scope, uint64_t entry);
+
+    [[nodiscard]] auto scope_matches(uint32_t scope, const std::vector<std::string_view> &qualifiers) const -> bool;
+
+    [[nodiscard]] auto name_at(uint64_t offset, uint32_t size) const -> std::string_view;
+
+    [[nodiscard]] auto group_name(uint32_t group) const -> std::string_view;
+
+    // collected, cleared by finalize
+    std::vector<scope> m_scopes{};
+    std::unordered_map<dwarf::section_offset, origin> m_origins{};
+    std::vector<deferred> m_deferred{};
+    std::vector<function> m_functions{};
+
+    std::string_view m_image{};
+
+    // the finalized scopes, names are offset and size in m_image
+    flat_array<uint64_t> m_scope_names{};
+    flat_array<uint32_t> m_scope_name_sizes{};
+    flat_array<uint32_t> m_scope_parents{};
+
+    // the finalized functions sorted by name. Functions with the same name
+    // form a group, group g is [m_group_begin[g], m_group_begin[g + 1]) and
+    // m_slots hashes the names to groups.
+    flat_array<uint64_t> m_names{};
+    flat_array<uint32_t> m_name_sizes{};
+    flat_array<uint32_t> m_function_scopes{};
+    flat_array<uint64_t> m_entries{};
+    flat_array<uint32_t> m_group_begin{};
+    flat_array<uint32_t> m_slots{};
+};
+
+
+#endif //DEBUGGER_FUNCTION_INDEX_H
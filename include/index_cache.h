@@ -0,0 +1,87 @@
+#ifndef DEBUGGER_INDEX_CACHE_H
+#define DEBUGGER_INDEX_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// On-disk cache of the indexes built from the DWARF of a binary, keyed by
+// its GNU build ID. The file is a header, a table with the offset and size of
+// every array and then the arrays themselves, 8-byte aligned, in the order
+// the indexes saved them. It is mapped as is on the next start and the
+// indexes use the arrays in place.
+//
+// A cache is rejected, and the indexes rebuilt, when its magic, version,
+// build ID or image size don't match, when it is truncated or when the
+// checksum over everything after the header doesn't match. Caches are
+// written to a temporary file and renamed into place, so a reader never sees
+// a partial file.
+namespace index_cache {
+    // bump whenever the layout or the contents of an index change
+    constexpr uint32_t version = 4;
+
+    // $XDG_CACHE_HOME/minidbg/<build id>.idx, falling back to ~/.cache, or
+    // empty when neither is known
+    auto path_for(std::string_view build_id) -> std::string;
+
+    // a cache file which doesn't have the arrays an index expects
+    class format_error : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    class writer {
+    public:
+        // the array is not copied, it has to stay alive until write()
+        template <typename T>
+        void add(std::span<const T> array) {
+            m_arrays.emplace_back(array.data(), array.size_bytes());
+        }
+
+        // false if the file couldn't be written, the cache is only an
+        // optimization
+        auto write(const std::string &path, std::string_view build_id, uint64_t image_size) const -> bool;
+
+    private:
+        std::vector<std::pair<const void *, std::size_t>> m_arrays{};
+    };
+
+    class reader {
+    public:
+        // nullptr when there is no usable cache at path
+        static auto open(const std::string &path, std::string_view build_id, uint64_t image_size)
+            -> std::unique_ptr<reader>;
+
+        reader(const void *data, std::size_t size);
+
+        ~reader();
+
+        reader(const reader &) = delete;
+
+        reader &operator=(const reader &) = delete;
+
+        // the next array, which stays mapped as long as the reader lives.
+        // Throws format_error when there are no more arrays or the next one
+        // can't hold Ts.
+        template <typename T>
+        auto next() -> std::span<const T> {
+            auto [data, size] = next_array(sizeof(T), alignof(T));
+            return {static_cast<const T *>(data), size / sizeof(T)};
+        }
+
+    private:
+        auto next_array(std::size_t element_size, std::size_t alignment) -> std::pair<const void *, std::size_t>;
+
+        const char *m_data;
+        std::size_t m_size;
+        std::size_t m_next{};
+    };
+}
+
+
+#endif //DEBUGGER_INDEX_CACHE_H
@@ -0,0 +1,80 @@
+#ifndef DEBUGGER_LINE_INDEX_H
+#define DEBUGGER_LINE_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "../external/libelfin/dwarf/dwarf++.hh"
+#include "flat_array.h"
+#include "index_cache.h"
+
+// (file, line) -> address lookup table. The statement rows of all line
+// tables are grouped by source file and sorted by line, the files are
+// hashed by their base name. A lookup probes the hash with the base name of
+// the requested path, keeps the files whose path ends with it and binary
+// searches their rows for the line.
+class line_index {
+public:
+    // collects the rows of one unit, call finalize() once all are added
+    void add_unit(const dwarf::compilation_unit &cu);
+
+    // takes over the rows collected by a shard built on another thread
+    void merge(line_index &&shard);
+
+    void finalize();
+
+    // writes the finalized tables to the cache
+    void save(index_cache::writer &out) const;
+
+    // uses the tables saved in the cache in place, instead of add_unit() and
+    // finalize(). Throws index_cache::format_error.
+    void load(index_cache::reader &in);
+
+    // sorted addresses of all statements at this line. file is matched
+    // against the end of the source paths on a directory boundary, so
+    // "main.cpp" and "app/main.cpp" both find "/src/app/main.cpp"
+    [[nodiscard]] auto find(const std::string &file, unsigned line) const -> std::vector<uint64_t>;
+
+    [[nodiscard]] auto empty() const -> bool;
+
+private:
+    struct row {
+        uint32_t file;
+        unsigned line;
+        uint64_t address;
+    };
+
+    [[nodiscard]] auto file_id(std::string path) -> uint32_t;
+
+    [[nodiscard]] auto path(uint32_t file) const -> std::string_view;
+
+    [[nodiscard]] auto basename_group(uint32_t group) const -> std::string_view;
+
+    // collected, cleared by finalize
+    std::vector<row> m_rows{};
+    std::vector<std::string> m_paths{}; // normalized, indexed by file id
+    std::unordered_map<std::string, uint32_t> m_file_ids{};
+
+    // the path of file f is [m_path_begin[f], m_path_begin[f + 1]) of
+    // m_path_chars
+    flat_array<char> m_path_chars{};
+    flat_array<uint32_t> m_path_begin{};
+
+    // the files are grouped by base name, group g is
+    // [m_basename_begin[g], m_basename_begin[g + 1]) of m_basename_files and
+    // m_basename_slots hashes the base names to groups
+    flat_array<uint32_t> m_basename_files{};
+    flat_array<uint32_t> m_basename_begin{};
+    flat_array<uint32_t> m_basename_slots{};
+
+    // the rows of file f are [m_file_begin[f], m_file_begin[f + 1]), sorted
+    // by line and address
+    flat_array<uint32_t> m_file_begin{};
+    flat_array<unsigned> m_lines{};
+    flat_array<uint64_t> m_addresses{};
+};
+
+
+#endif //DEBUGGER_LINE_INDEX_H
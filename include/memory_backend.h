@@ -0,0 +1,65 @@
+#ifndef DEBUGGER_MEMORY_BACKEND_H
+#define DEBUGGER_MEMORY_BACKEND_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Raw access to the tracee's address space. target_memory caches on top of
+// one of these and picks the implementation at runtime.
+class memory_backend {
+public:
+    virtual ~memory_backend() = default;
+
+    // scatter length bytes starting at address into the local buffers,
+    // returns the number of bytes actually read
+    virtual auto read(uint64_t address, const iovec *local, std::size_t count) -> std::size_t = 0;
+
+    // returns false if the backend could not write the whole range
+    virtual auto write(uint64_t address, const void *buffer, std::size_t length) -> bool = 0;
+
+    [[nodiscard]] virtual auto name() const -> const char * = 0;
+};
+
+// process_vm_readv for reads, PTRACE_POKEDATA for writes. Always available
+// for a ptrace-stopped tracee but writes cost a syscall per word.
+class ptrace_backend : public memory_backend {
+public:
+    explicit ptrace_backend(pid_t pid);
+
+    auto read(uint64_t address, const iovec *local, std::size_t count) -> std::size_t override;
+
+    auto write(uint64_t address, const void *buffer, std::size_t length) -> bool override;
+
+    [[nodiscard]] auto name() const -> const char * override;
+
+private:
+    pid_t m_pid;
+};
+
+// pread/pwrite on /proc/<pid>/mem. Any length is a single syscall and the
+// kernel writes through read-only mappings for us, so no read-modify-write
+// of whole words is needed.
+class proc_mem_backend : public memory_backend {
+public:
+    explicit proc_mem_backend(int fd);
+
+    ~proc_mem_backend() override;
+
+    // returns nullptr if /proc/<pid>/mem cannot be opened for writing
+    static auto open(pid_t pid) -> std::unique_ptr<proc_mem_backend>;
+
+    auto read(uint64_t address, const iovec *local, std::size_t count) -> std::size_t override;
+
+    auto write(uint64_t address, const void *buffer, std::size_t length) -> bool override;
+
+    [[nodiscard]] auto name() const -> const char * override;
+
+private:
+    int m_fd;
+};
+
+
+#endif //DEBUGGER_MEMORY_BACKEND_H
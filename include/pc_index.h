@@ -0,0 +1,70 @@
+#ifndef DEBUGGER_PC_INDEX_H
+#define DEBUGGER_PC_INDEX_H
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include "../external/libelfin/dwarf/dwarf++.hh"
+#include "flat_array.h"
+#include "index_cache.h"
+
+// PC -> scope lookup table. The pc ranges of all subprograms, inlined
+// subroutines and lexical blocks are flattened into sorted, non-overlapping
+// segments, each mapped to the innermost scope covering it and to the
+// subprogram containing that scope. A lookup is a binary search over the
+// segment start addresses and does not decode any DIE.
+class pc_index {
+public:
+    // collects the scopes of one unit, call finalize() once all are added
+    void add_unit(const dwarf::unit &cu);
+
+    // takes over the scopes collected by a shard built on another thread
+    void merge(pc_index &&shard);
+
+    void finalize();
+
+    // writes the finalized segments to the cache
+    void save(index_cache::writer &out) const;
+
+    // uses the segments saved in the cache in place, instead of add_unit()
+    // and finalize(). Throws index_cache::format_error.
+    void load(index_cache::reader &in);
+
+    // section offset of the subprogram whose code contains pc
+    [[nodiscard]] auto function_at(uint64_t pc) const -> std::optional<dwarf::section_offset>;
+
+    // section offset of the innermost subprogram or inlined subroutine
+    // containing pc, which tells apart the inlined copies of a function
+    [[nodiscard]] auto instance_at(uint64_t pc) const -> std::optional<dwarf::section_offset>;
+
+    // section offset of the innermost scope containing pc
+    [[nodiscard]] auto scope_at(uint64_t pc) const -> std::optional<dwarf::section_offset>;
+
+    [[nodiscard]] auto empty() const -> bool;
+
+private:
+    struct scope {
+        uint64_t low;
+        uint64_t high;
+        dwarf::section_offset die;
+        dwarf::section_offset function;
+        dwarf::section_offset instance;
+    };
+
+    void add_scopes(const dwarf::die &parent, std::optional<dwarf::section_offset> function,
+                    std::optional<dwarf::section_offset> instance);
+
+    [[nodiscard]] auto find(uint64_t pc) const -> std::optional<std::size_t>;
+
+    std::vector<scope> m_scopes{}; // collected, cleared by finalize
+
+    // the segments, split into arrays so the search only touches m_lows
+    flat_array<uint64_t> m_lows{};
+    flat_array<uint64_t> m_highs{};
+    flat_array<dwarf::section_offset> m_dies{};
+    flat_array<dwarf::section_offset> m_functions{};
+    flat_array<dwarf::section_offset> m_instances{};
+};
+
+
+#endif //DEBUGGER_PC_INDEX_H
@@ -3,13 +3,21 @@
 //
 
 #include <sys/ptrace.h>
+#include <sys/uio.h>
 #include <sys/user.h>
+#include <cpuid.h>
+#include <elf.h>
 
+#include <algorithm>
 #include <array>
-#include <boost/array.hpp>
-#include <boost/iterator.hpp>
+#include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #ifndef DEBUGGER_REGISTERS_H
 #define DEBUGGER_REGISTERS_H
@@ -41,99 +49,542 @@ enum class reg {
     gs,
     ss,
     ds,
-    es
+    es,
+    st0,
+    st1,
+    st2,
+    st3,
+    st4,
+    st5,
+    st6,
+    st7,
+    mxcsr,
+    xmm0,
+    xmm1,
+    xmm2,
+    xmm3,
+    xmm4,
+    xmm5,
+    xmm6,
+    xmm7,
+    xmm8,
+    xmm9,
+    xmm10,
+    xmm11,
+    xmm12,
+    xmm13,
+    xmm14,
+    xmm15,
+    ymm0,
+    ymm1,
+    ymm2,
+    ymm3,
+    ymm4,
+    ymm5,
+    ymm6,
+    ymm7,
+    ymm8,
+    ymm9,
+    ymm10,
+    ymm11,
+    ymm12,
+    ymm13,
+    ymm14,
+    ymm15,
+    zmm0,
+    zmm1,
+    zmm2,
+    zmm3,
+    zmm4,
+    zmm5,
+    zmm6,
+    zmm7,
+    zmm8,
+    zmm9,
+    zmm10,
+    zmm11,
+    zmm12,
+    zmm13,
+    zmm14,
+    zmm15,
+    zmm16,
+    zmm17,
+    zmm18,
+    zmm19,
+    zmm20,
+    zmm21,
+    zmm22,
+    zmm23,
+    zmm24,
+    zmm25,
+    zmm26,
+    zmm27,
+    zmm28,
+    zmm29,
+    zmm30,
+    zmm31,
+    k0,
+    k1,
+    k2,
+    k3,
+    k4,
+    k5,
+    k6,
+    k7
 };
 
-constexpr std::size_t n_registers = 27;
+constexpr std::size_t n_registers = 108;
+
+// where the value of a register lives: the general purpose registers come
+// from user_regs_struct, everything else from the XSAVE area
+enum class reg_bank {
+    gpr,
+    x87,         // legacy region, st0-st7
+    sse,         // legacy region, xmm0-xmm15 and mxcsr
+    avx,         // YMM_Hi128 component, upper halves of ymm0-ymm15
+    avx512,      // ZMM_Hi256 component, upper halves of zmm0-zmm15
+    avx512_hi16, // Hi16_ZMM component, zmm16-zmm31
+    opmask,      // opmask component, k0-k7
+};
 
 struct reg_descriptor {
     reg r;
     int dwarf_r;
-    std::string name;
+    std::string_view name;
+    reg_bank bank;
+    std::size_t offset; // byte offset of the register within its bank
+    std::size_t size;
 };
 
-const boost::array <reg_descriptor, n_registers>
+// indexed by reg, so the descriptor of a register is a single load
+constexpr std::array<reg_descriptor, n_registers>
         g_registers_descriptors{
         {
-                {reg::r15, 15, "r15"},
-                {reg::r14, 14, "r14"},
-                {reg::r13, 13, "r13"},
-                {reg::r12, 12, "r12"},
-                {reg::rbp, 6, "rbp"},
-                {reg::rbx, 3, "rbx"},
-                {reg::r11, 11, "r11"},
-                {reg::r10, 10, "r10"},
-                {reg::r9, 9, "r9"},
-                {reg::r8, 8, "r8"},
-                {reg::rax, 0, "rax"},
-                {reg::rcx, 2, "rcx"},
-                {reg::rdx, 1, "rdx"},
-                {reg::rsi, 4, "rsi"},
-                {reg::rdi, 5, "rdi"},
-                {reg::orig_rax, -1, "orig_rax"},
-                {reg::rip, -1, "rip"},
-                {reg::cs, 51, "cs"},
-                {reg::rflags, 49, "eflags"},
-                {reg::rsp, 7, "rsp"},
-                {reg::ss, 52, "ss"},
-                {reg::fs_base, 58, "fs_base"},
-                {reg::gs_base, 59, "gs_base"},
-                {reg::ds, 53, "ds"},
-                {reg::es, 50, "es"},
-                {reg::fs, 54, "fs"},
-                {reg::gs, 55, "gs"},
+                {reg::rax, 0, "rax", reg_bank::gpr, offsetof(user_regs_struct, rax), 8},
+                {reg::rbx, 3, "rbx", reg_bank::gpr, offsetof(user_regs_struct, rbx), 8},
+                {reg::rcx, 2, "rcx", reg_bank::gpr, offsetof(user_regs_struct, rcx), 8},
+                {reg::rdx, 1, "rdx", reg_bank::gpr, offsetof(user_regs_struct, rdx), 8},
+                {reg::rdi, 5, "rdi", reg_bank::gpr, offsetof(user_regs_struct, rdi), 8},
+                {reg::rsi, 4, "rsi", reg_bank::gpr, offsetof(user_regs_struct, rsi), 8},
+                {reg::rbp, 6, "rbp", reg_bank::gpr, offsetof(user_regs_struct, rbp), 8},
+                {reg::rsp, 7, "rsp", reg_bank::gpr, offsetof(user_regs_struct, rsp), 8},
+                {reg::r8, 8, "r8", reg_bank::gpr, offsetof(user_regs_struct, r8), 8},
+                {reg::r9, 9, "r9", reg_bank::gpr, offsetof(user_regs_struct, r9), 8},
+                {reg::r10, 10, "r10", reg_bank::gpr, offsetof(user_regs_struct, r10), 8},
+                {reg::r11, 11, "r11", reg_bank::gpr, offsetof(user_regs_struct, r11), 8},
+                {reg::r12, 12, "r12", reg_bank::gpr, offsetof(user_regs_struct, r12), 8},
+                {reg::r13, 13, "r13", reg_bank::gpr, offsetof(user_regs_struct, r13), 8},
+                {reg::r14, 14, "r14", reg_bank::gpr, offsetof(user_regs_struct, r14), 8},
+                {reg::r15, 15, "r15", reg_bank::gpr, offsetof(user_regs_struct, r15), 8},
+                {reg::rip, -1, "rip", reg_bank::gpr, offsetof(user_regs_struct, rip), 8},
+                {reg::rflags, 49, "eflags", reg_bank::gpr, offsetof(user_regs_struct, eflags), 8},
+                {reg::cs, 51, "cs", reg_bank::gpr, offsetof(user_regs_struct, cs), 8},
+                {reg::orig_rax, -1, "orig_rax", reg_bank::gpr, offsetof(user_regs_struct, orig_rax), 8},
+                {reg::fs_base, 58, "fs_base", reg_bank::gpr, offsetof(user_regs_struct, fs_base), 8},
+                {reg::gs_base, 59, "gs_base", reg_bank::gpr, offsetof(user_regs_struct, gs_base), 8},
+                {reg::fs, 54, "fs", reg_bank::gpr, offsetof(user_regs_struct, fs), 8},
+                {reg::gs, 55, "gs", reg_bank::gpr, offsetof(user_regs_struct, gs), 8},
+                {reg::ss, 52, "ss", reg_bank::gpr, offsetof(user_regs_struct, ss), 8},
+                {reg::ds, 53, "ds", reg_bank::gpr, offsetof(user_regs_struct, ds), 8},
+                {reg::es, 50, "es", reg_bank::gpr, offsetof(user_regs_struct, es), 8},
+                {reg::st0, 33, "st0", reg_bank::x87, 32, 10},
+                {reg::st1, 34, "st1", reg_bank::x87, 48, 10},
+                {reg::st2, 35, "st2", reg_bank::x87, 64, 10},
+                {reg::st3, 36, "st3", reg_bank::x87, 80, 10},
+                {reg::st4, 37, "st4", reg_bank::x87, 96, 10},
+                {reg::st5, 38, "st5", reg_bank::x87, 112, 10},
+                {reg::st6, 39, "st6", reg_bank::x87, 128, 10},
+                {reg::st7, 40, "st7", reg_bank::x87, 144, 10},
+                {reg::mxcsr, 64, "mxcsr", reg_bank::sse, 24, 4},
+                {reg::xmm0, 17, "xmm0", reg_bank::sse, 160, 16},
+                {reg::xmm1, 18, "xmm1", reg_bank::sse, 176, 16},
+                {reg::xmm2, 19, "xmm2", reg_bank::sse, 192, 16},
+                {reg::xmm3, 20, "xmm3", reg_bank::sse, 208, 16},
+                {reg::xmm4, 21, "xmm4", reg_bank::sse, 224, 16},
+                {reg::xmm5, 22, "xmm5", reg_bank::sse, 240, 16},
+                {reg::xmm6, 23, "xmm6", reg_bank::sse, 256, 16},
+                {reg::xmm7, 24, "xmm7", reg_bank::sse, 272, 16},
+                {reg::xmm8, 25, "xmm8", reg_bank::sse, 288, 16},
+                {reg::xmm9, 26, "xmm9", reg_bank::sse, 304, 16},
+                {reg::xmm10, 27, "xmm10", reg_bank::sse, 320, 16},
+                {reg::xmm11, 28, "xmm11", reg_bank::sse, 336, 16},
+                {reg::xmm12, 29, "xmm12", reg_bank::sse, 352, 16},
+                {reg::xmm13, 30, "xmm13", reg_bank::sse, 368, 16},
+                {reg::xmm14, 31, "xmm14", reg_bank::sse, 384, 16},
+                {reg::xmm15, 32, "xmm15", reg_bank::sse, 400, 16},
+                {reg::ymm0, -1, "ymm0", reg_bank::avx, 0, 32},
+                {reg::ymm1, -1, "ymm1", reg_bank::avx, 16, 32},
+                {reg::ymm2, -1, "ymm2", reg_bank::avx, 32, 32},
+                {reg::ymm3, -1, "ymm3", reg_bank::avx, 48, 32},
+                {reg::ymm4, -1, "ymm4", reg_bank::avx, 64, 32},
+                {reg::ymm5, -1, "ymm5", reg_bank::avx, 80, 32},
+                {reg::ymm6, -1, "ymm6", reg_bank::avx, 96, 32},
+                {reg::ymm7, -1, "ymm7", reg_bank::avx, 112, 32},
+                {reg::ymm8, -1, "ymm8", reg_bank::avx, 128, 32},
+                {reg::ymm9, -1, "ymm9", reg_bank::avx, 144, 32},
+                {reg::ymm10, -1, "ymm10", reg_bank::avx, 160, 32},
+                {reg::ymm11, -1, "ymm11", reg_bank::avx, 176, 32},
+                {reg::ymm12, -1, "ymm12", reg_bank::avx, 192, 32},
+                {reg::ymm13, -1, "ymm13", reg_bank::avx, 208, 32},
+                {reg::ymm14, -1, "ymm14", reg_bank::avx, 224, 32},
+                {reg::ymm15, -1, "ymm15", reg_bank::avx, 240, 32},
+                {reg::zmm0, -1, "zmm0", reg_bank::avx512, 0, 64},
+                {reg::zmm1, -1, "zmm1", reg_bank::avx512, 32, 64},
+                {reg::zmm2, -1, "zmm2", reg_bank::avx512, 64, 64},
+                {reg::zmm3, -1, "zmm3", reg_bank::avx512, 96, 64},
+                {reg::zmm4, -1, "zmm4", reg_bank::avx512, 128, 64},
+                {reg::zmm5, -1, "zmm5", reg_bank::avx512, 160, 64},
+                {reg::zmm6, -1, "zmm6", reg_bank::avx512, 192, 64},
+                {reg::zmm7, -1, "zmm7", reg_bank::avx512, 224, 64},
+                {reg::zmm8, -1, "zmm8", reg_bank::avx512, 256, 64},
+                {reg::zmm9, -1, "zmm9", reg_bank::avx512, 288, 64},
+                {reg::zmm10, -1, "zmm10", reg_bank::avx512, 320, 64},
+                {reg::zmm11, -1, "zmm11", reg_bank::avx512, 352, 64},
+                {reg::zmm12, -1, "zmm12", reg_bank::avx512, 384, 64},
+                {reg::zmm13, -1, "zmm13", reg_bank::avx512, 416, 64},
+                {reg::zmm14, -1, "zmm14", reg_bank::avx512, 448, 64},
+                {reg::zmm15, -1, "zmm15", reg_bank::avx512, 480, 64},
+                {reg::zmm16, -1, "zmm16", reg_bank::avx512_hi16, 0, 64},
+                {reg::zmm17, -1, "zmm17", reg_bank::avx512_hi16, 64, 64},
+                {reg::zmm18, -1, "zmm18", reg_bank::avx512_hi16, 128, 64},
+                {reg::zmm19, -1, "zmm19", reg_bank::avx512_hi16, 192, 64},
+                {reg::zmm20, -1, "zmm20", reg_bank::avx512_hi16, 256, 64},
+                {reg::zmm21, -1, "zmm21", reg_bank::avx512_hi16, 320, 64},
+                {reg::zmm22, -1, "zmm22", reg_bank::avx512_hi16, 384, 64},
+                {reg::zmm23, -1, "zmm23", reg_bank::avx512_hi16, 448, 64},
+                {reg::zmm24, -1, "zmm24", reg_bank::avx512_hi16, 512, 64},
+                {reg::zmm25, -1, "zmm25", reg_bank::avx512_hi16, 576, 64},
+                {reg::zmm26, -1, "zmm26", reg_bank::avx512_hi16, 640, 64},
+                {reg::zmm27, -1, "zmm27", reg_bank::avx512_hi16, 704, 64},
+                {reg::zmm28, -1, "zmm28", reg_bank::avx512_hi16, 768, 64},
+                {reg::zmm29, -1, "zmm29", reg_bank::avx512_hi16, 832, 64},
+                {reg::zmm30, -1, "zmm30", reg_bank::avx512_hi16, 896, 64},
+                {reg::zmm31, -1, "zmm31", reg_bank::avx512_hi16, 960, 64},
+                {reg::k0, 118, "k0", reg_bank::opmask, 0, 8},
+                {reg::k1, 119, "k1", reg_bank::opmask, 8, 8},
+                {reg::k2, 120, "k2", reg_bank::opmask, 16, 8},
+                {reg::k3, 121, "k3", reg_bank::opmask, 24, 8},
+                {reg::k4, 122, "k4", reg_bank::opmask, 32, 8},
+                {reg::k5, 123, "k5", reg_bank::opmask, 40, 8},
+                {reg::k6, 124, "k6", reg_bank::opmask, 48, 8},
+                {reg::k7, 125, "k7", reg_bank::opmask, 56, 8},
         }};
 
-uint64_t get_register_value(pid_t pid, reg r) {
-    user_regs_struct regs{};
-    ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
-    const reg_descriptor *it =
-            std::find_if(std::begin(g_registers_descriptors),
-                         std::end(g_registers_descriptors),
-                         [r](auto &&rd) { return rd.r == r; });
-    return *(reinterpret_cast<uint64_t *>(&regs) +
-             (it - std::begin(g_registers_descriptors)));
+namespace register_tables {
+    constexpr bool descriptors_are_consistent() {
+        for (std::size_t i = 0; i < g_registers_descriptors.size(); ++i) {
+            const auto &rd = g_registers_descriptors[i];
+            if (static_cast<std::size_t>(rd.r) != i || rd.size > 64) {
+                return false;
+            }
+            if (rd.bank == reg_bank::gpr &&
+                (rd.size != sizeof(uint64_t) || rd.offset % sizeof(uint64_t) != 0 ||
+                 rd.offset + sizeof(uint64_t) > sizeof(user_regs_struct))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static_assert(descriptors_are_consistent(),
+                  "g_registers_descriptors must be ordered like reg and the general purpose registers "
+                  "must point into user_regs_struct");
+    static_assert(g_registers_descriptors[static_cast<std::size_t>(reg::rip)].offset ==
+                  offsetof(user_regs_struct, rip));
+    static_assert(g_registers_descriptors[static_cast<std::size_t>(reg::rsp)].offset ==
+                  offsetof(user_regs_struct, rsp));
+    static_assert(g_registers_descriptors[static_cast<std::size_t>(reg::rbp)].offset ==
+                  offsetof(user_regs_struct, rbp));
+    static_assert(g_registers_descriptors[static_cast<std::size_t>(reg::rflags)].offset ==
+                  offsetof(user_regs_struct, eflags));
+    static_assert(g_registers_descriptors[static_cast<std::size_t>(reg::xmm0)].dwarf_r == 17);
+    static_assert(g_registers_descriptors[static_cast<std::size_t>(reg::xmm15)].dwarf_r == 32);
+
+    constexpr uint8_t no_register = 0xff;
+    static_assert(n_registers < no_register);
+
+    // DWARF register number -> index into g_registers_descriptors
+    constexpr std::size_t max_dwarf_register() {
+        int max = 0;
+        for (const auto &rd: g_registers_descriptors) {
+            max = rd.dwarf_r > max ? rd.dwarf_r : max;
+        }
+        return static_cast<std::size_t>(max);
+    }
+
+    constexpr auto by_dwarf = [] {
+        std::array<uint8_t, max_dwarf_register() + 1> table{};
+        table.fill(no_register);
+        for (std::size_t i = 0; i < g_registers_descriptors.size(); ++i) {
+            if (g_registers_descriptors[i].dwarf_r >= 0) {
+                table[g_registers_descriptors[i].dwarf_r] = static_cast<uint8_t>(i);
+            }
+        }
+        return table;
+    }();
+
+    // register name -> index into g_registers_descriptors through a perfect
+    // hash, the seed is searched at compile time so that no two names share
+    // a slot
+    constexpr uint32_t hash_name(std::string_view name, uint32_t seed) {
+        uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+        for (char c: name) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    constexpr std::size_t name_table_size = std::bit_ceil(n_registers * n_registers / 2);
+
+    constexpr uint32_t find_name_seed() {
+        for (uint32_t seed = 0; seed < 4096; ++seed) {
+            std::array<bool, name_table_size> used{};
+            bool collision = false;
+            for (const auto &rd: g_registers_descriptors) {
+                auto slot = hash_name(rd.name, seed) & (name_table_size - 1);
+                collision = collision || used[slot];
+                used[slot] = true;
+            }
+            if (!collision) {
+                return seed;
+            }
+        }
+        return ~0u;
+    }
+
+    constexpr uint32_t name_seed = find_name_seed();
+    static_assert(name_seed != ~0u, "no perfect hash seed for the register names");
+
+    constexpr auto by_name = [] {
+        std::array<uint8_t, name_table_size> table{};
+        table.fill(no_register);
+        for (std::size_t i = 0; i < g_registers_descriptors.size(); ++i) {
+            table[hash_name(g_registers_descriptors[i].name, name_seed) & (name_table_size - 1)] =
+                    static_cast<uint8_t>(i);
+        }
+        return table;
+    }();
+}
+
+constexpr const reg_descriptor &get_register_descriptor(reg r) {
+    return g_registers_descriptors[static_cast<std::size_t>(r)];
+}
+
+// Layout of the XSAVE area as returned by PTRACE_GETREGSET(NT_X86_XSTATE).
+// The kernel hands it out in the standard (non-compacted) format, so the
+// component offsets are the ones reported by CPUID leaf 0xd.
+struct xsave_layout {
+    static constexpr std::size_t legacy_size = 512;
+    static constexpr std::size_t xstate_bv_offset = 512;
+
+    enum component {
+        x87 = 0,
+        sse = 1,
+        avx = 2,
+        opmask = 5,
+        zmm_hi256 = 6,
+        hi16_zmm = 7,
+        n_components
+    };
+
+    std::size_t size = legacy_size;
+    std::array<uint32_t, n_components> offsets{};
+    std::array<uint32_t, n_components> sizes{};
+
+    static const xsave_layout &get() {
+        static const xsave_layout layout = [] {
+            xsave_layout l{};
+            unsigned eax, ebx, ecx, edx;
+            if (!__get_cpuid_count(0xd, 0, &eax, &ebx, &ecx, &edx)) {
+                return l;
+            }
+            l.size = ebx; // size needed for the features enabled in XCR0
+            for (unsigned c = avx; c < n_components; ++c) {
+                if (__get_cpuid_count(0xd, c, &eax, &ebx, &ecx, &edx) && eax) {
+                    l.sizes[c] = eax;
+                    l.offsets[c] = ebx;
+                }
+            }
+            return l;
+        }();
+        return layout;
+    }
+};
+
+// Register file of one thread. It is fetched with a single PTRACE_GETREGS the
+// first time a register is read during a stop, writes only mark it dirty and
+// are flushed with one PTRACE_SETREGS before the thread runs again. The XSAVE
+// area is much larger and only fetched when a vector or x87 register is asked
+// for.
+class register_cache {
+public:
+    explicit register_cache(pid_t tid) : m_tid{tid} {}
+
+    uint64_t get(std::size_t offset) {
+        uint64_t value;
+        std::memcpy(&value, reinterpret_cast<const char *>(&fetch()) + offset, sizeof(value));
+        return value;
+    }
+
+    void set(std::size_t offset, uint64_t value) {
+        std::memcpy(reinterpret_cast<char *>(&fetch()) + offset, &value, sizeof(value));
+        m_dirty = true;
+    }
+
+    // pointer to the offset'th byte of the given XSAVE component, or nullptr
+    // if the component is in its initial (all zero) state
+    const uint8_t *xstate(xsave_layout::component c, std::size_t offset) {
+        const auto &layout = xsave_layout::get();
+        fetch_xstate();
+
+        if (c >= xsave_layout::avx) {
+            if (!layout.sizes[c] || offset >= layout.sizes[c]) {
+                throw std::out_of_range{"register is not supported by this CPU"};
+            }
+            if (!(m_xstate_bv & (uint64_t{1} << c))) {
+                return nullptr;
+            }
+            return m_xstate.data() + layout.offsets[c] + offset;
+        }
+        return m_xstate.data() + offset;
+    }
+
+    // write back pending changes, has to be called before resuming the thread
+    void flush() {
+        if (m_dirty) {
+            ptrace(PTRACE_SETREGS, m_tid, nullptr, &m_regs);
+            m_dirty = false;
+        }
+    }
+
+    // forget the register file, the thread is about to run
+    void invalidate() {
+        m_valid = false;
+        m_dirty = false;
+        m_xstate_valid = false;
+    }
+
+private:
+    user_regs_struct &fetch() {
+        if (!m_valid) {
+            ptrace(PTRACE_GETREGS, m_tid, nullptr, &m_regs);
+            m_valid = true;
+        }
+        return m_regs;
+    }
+
+    void fetch_xstate() {
+        if (m_xstate_valid) {
+            return;
+        }
+        const auto &layout = xsave_layout::get();
+        m_xstate.assign(std::max(layout.size, xsave_layout::legacy_size + 64), 0);
+
+        iovec iov{m_xstate.data(), m_xstate.size()};
+        if (ptrace(PTRACE_GETREGSET, m_tid, NT_X86_XSTATE, &iov) == 0 &&
+            iov.iov_len > xsave_layout::xstate_bv_offset) {
+            std::memcpy(&m_xstate_bv, m_xstate.data() + xsave_layout::xstate_bv_offset, sizeof(m_xstate_bv));
+        } else {
+            // no XSAVE support, the legacy FXSAVE region is all there is
+            ptrace(PTRACE_GETFPREGS, m_tid, nullptr, m_xstate.data());
+            m_xstate_bv = (uint64_t{1} << xsave_layout::x87) | (uint64_t{1} << xsave_layout::sse);
+        }
+        m_xstate_valid = true;
+    }
+
+    pid_t m_tid;
+    user_regs_struct m_regs{};
+    bool m_valid = false;
+    bool m_dirty = false;
+
+    std::vector<uint8_t> m_xstate{};
+    uint64_t m_xstate_bv = 0;
+    bool m_xstate_valid = false;
+};
+
+// the raw little-endian bytes of any register
+inline std::vector<uint8_t> get_register_bytes(register_cache &regs, reg r) {
+    const auto &rd = get_register_descriptor(r);
+    std::vector<uint8_t> value(rd.size);
+
+    auto copy = [&](std::size_t at, xsave_layout::component c, std::size_t offset, std::size_t size) {
+        if (auto p = regs.xstate(c, offset)) {
+            std::memcpy(value.data() + at, p, size);
+        }
+    };
+
+    switch (rd.bank) {
+        case reg_bank::gpr: {
+            auto v = regs.get(rd.offset);
+            std::memcpy(value.data(), &v, sizeof(v));
+            break;
+        }
+        case reg_bank::x87:
+        case reg_bank::sse:
+            copy(0, xsave_layout::x87, rd.offset, rd.size);
+            break;
+        case reg_bank::avx: // xmm in the low half, YMM_Hi128 in the high half
+            copy(0, xsave_layout::sse, 160 + rd.offset, 16);
+            copy(16, xsave_layout::avx, rd.offset, 16);
+            break;
+        case reg_bank::avx512: // ymm in the low half, ZMM_Hi256 in the high half
+            copy(0, xsave_layout::sse, 160 + rd.offset / 2, 16);
+            copy(16, xsave_layout::avx, rd.offset / 2, 16);
+            copy(32, xsave_layout::zmm_hi256, rd.offset, 32);
+            break;
+        case reg_bank::avx512_hi16:
+            copy(0, xsave_layout::hi16_zmm, rd.offset, rd.size);
+            break;
+        case reg_bank::opmask:
+            copy(0, xsave_layout::opmask, rd.offset, rd.size);
+            break;
+    }
+    return value;
 }
 
-void set_register_value(pid_t pid, reg r, uint64_t value) {
-    user_regs_struct regs{};
-    ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
-    const reg_descriptor *it =
-            std::find_if(std::begin(g_registers_descriptors),
-                         std::end(g_registers_descriptors),
-                         [r](auto &&rd) { return rd.r == r; });
-    *(reinterpret_cast<uint64_t *>(&regs) +
-      (it - std::begin(g_registers_descriptors))) = value;
-    ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+// for registers wider than 64 bits this is the lowest 64 bits, which is
+// the scalar lane of a vector register
+inline uint64_t get_register_value(register_cache &regs, reg r) {
+    const auto &rd = get_register_descriptor(r);
+    if (rd.bank == reg_bank::gpr) {
+        return regs.get(rd.offset);
+    }
+    uint64_t value = 0;
+    auto bytes = get_register_bytes(regs, r);
+    std::memcpy(&value, bytes.data(), std::min(bytes.size(), sizeof(value)));
+    return value;
+}
+
+inline void set_register_value(register_cache &regs, reg r, uint64_t value) {
+    const auto &rd = get_register_descriptor(r);
+    if (rd.bank != reg_bank::gpr) {
+        throw std::invalid_argument{"only general purpose registers can be written"};
+    }
+    regs.set(rd.offset, value);
 }
 
 
-uint64_t get_register_value_from_dwarf_register(pid_t pid, unsigned regnum) {
-    const reg_descriptor *it =
-            std::find_if(std::begin(g_registers_descriptors),
-                         std::end(g_registers_descriptors),
-                         [regnum](auto &&rd) { return rd.dwarf_r == regnum; });
-    if (it == std::end(g_registers_descriptors)) {
+inline uint64_t get_register_value_from_dwarf_register(register_cache &regs, unsigned regnum) {
+    if (regnum >= register_tables::by_dwarf.size() ||
+        register_tables::by_dwarf[regnum] == register_tables::no_register) {
         throw std::out_of_range{"Unknown dwarf register"};
     }
-    return get_register_value(pid, it->r);
+    return get_register_value(regs, g_registers_descriptors[register_tables::by_dwarf[regnum]].r);
 }
 
-std::string get_register_name(reg r) {
-    const reg_descriptor *it =
-            std::find_if(std::begin(g_registers_descriptors),
-                         std::end(g_registers_descriptors),
-                         [r](auto &&rd) { return rd.r == r; });
-    return it->name;
+inline std::string get_register_name(reg r) {
+    return std::string{get_register_descriptor(r).name};
 }
 
-reg get_register_from_name(const std::string &name) {
-    const reg_descriptor *it =
-            std::find_if(std::begin(g_registers_descriptors),
-                         std::end(g_registers_descriptors),
-                         [name](auto &&rd) { return rd.name == name; });
-    return it->r;
+inline reg get_register_from_name(std::string_view name) {
+    auto slot = register_tables::hash_name(name, register_tables::name_seed) &
+                (register_tables::name_table_size - 1);
+    auto index = register_tables::by_name[slot];
+    if (index == register_tables::no_register || g_registers_descriptors[index].name != name) {
+        throw std::out_of_range{"Unknown register"};
+    }
+    return g_registers_descriptors[index].r;
 }
 
 #endif    // DEBUGGER_REGISTERS_H
-
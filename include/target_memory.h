@@ -0,0 +1,56 @@
+#ifndef DEBUGGER_TARGET_MEMORY_H
+#define DEBUGGER_TARGET_MEMORY_H
+
+#include <sys/types.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include "memory_backend.h"
+
+// Access layer for the tracee's address space. Reads are done in whole pages
+// and the pages are kept until the tracee is resumed, so consumers can read
+// word by word without paying a syscall per word. The backend is
+// /proc/<pid>/mem when it can be opened and ptrace otherwise.
+class target_memory {
+public:
+    static constexpr std::size_t page_size = 4096;
+
+    explicit target_memory(pid_t pid);
+
+    void read(uint64_t address, void *buffer, std::size_t length);
+
+    uint64_t read_word(uint64_t address);
+
+    uint8_t read_byte(uint64_t address);
+
+    // writes can patch read-only code pages and update the cached copy of
+    // the pages as well. Throws std::runtime_error when neither the backend
+    // nor ptrace can write the range.
+    void write(uint64_t address, const void *buffer, std::size_t length);
+
+    void write_word(uint64_t address, uint64_t value);
+
+    // drop all cached pages, has to be called before the tracee runs again
+    void invalidate();
+
+    [[nodiscard]] auto backend_name() const -> const char *;
+
+private:
+    using page = std::array<uint8_t, page_size>;
+
+    void fetch_pages(uint64_t first, uint64_t last);
+
+    void peek_page(uint64_t base, page &p);
+
+    pid_t m_pid;
+    std::unique_ptr<memory_backend> m_backend;
+    // used when the selected backend refuses a write, e.g. when the kernel
+    // forbids writing through /proc/<pid>/mem
+    ptrace_backend m_ptrace;
+    std::unordered_map<uint64_t, page> m_pages;
+};
+
+
+#endif //DEBUGGER_TARGET_MEMORY_H
@@ -0,0 +1,68 @@
+#ifndef DEBUGGER_THREAD_POOL_H
+#define DEBUGGER_THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running batches of independent tasks. Each batch is
+// dealt out round robin into one queue per worker, a worker takes tasks from
+// the front of its own queue and, once that is empty, steals from the back of
+// the others. A few expensive tasks (huge compilation units) then don't leave
+// the other workers idle. The thread calling run() is worker 0.
+class thread_pool {
+public:
+    // 0 picks the number of hardware threads
+    explicit thread_pool(std::size_t n_workers = 0);
+
+    ~thread_pool();
+
+    thread_pool(const thread_pool &) = delete;
+
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    [[nodiscard]] auto size() const -> std::size_t;
+
+    // calls fn(task, worker) for every task in [0, n_tasks), with worker in
+    // [0, size()) so results can go into per-worker shards without locking.
+    // Returns once all tasks ran, rethrows the first exception of a task.
+    void run(std::size_t n_tasks, const std::function<void(std::size_t, std::size_t)> &fn);
+
+private:
+    struct queue {
+        std::mutex mutex;
+        std::deque<std::size_t> tasks;
+    };
+
+    void worker(std::size_t id);
+
+    void work(std::size_t id);
+
+    auto take(std::size_t id) -> std::optional<std::size_t>;
+
+    std::vector<std::unique_ptr<queue>> m_queues;
+    std::vector<std::thread> m_threads{};
+
+    std::mutex m_mutex; // protects the members below
+    std::condition_variable m_wake{};
+    std::condition_variable m_done{};
+    const std::function<void(std::size_t, std::size_t)> *m_fn{};
+    uint64_t m_batch{};
+    std::size_t m_running{};
+    std::exception_ptr m_error{};
+    bool m_stop{};
+
+    std::atomic<bool> m_failed{}; // a task of the current batch threw
+};
+
+
+#endif //DEBUGGER_THREAD_POOL_H
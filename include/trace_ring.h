@@ -0,0 +1,81 @@
+#ifndef DEBUGGER_TRACE_RING_H
+#define DEBUGGER_TRACE_RING_H
+
+#include <sys/types.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Layout of the shared memory between the debugger and the in-process agent
+// (agent/agent.cpp). The agent creates it when it is preloaded into the
+// tracee, the debugger maps it when the first tracepoint is set.
+//
+// The debugger fills in the tracepoint descriptors and consumes the records,
+// every thread of the tracee which runs over a tracepoint produces one
+// record. Producers reserve a slot by advancing head and publish it by
+// storing its sequence number, the consumer advances tail once it copied the
+// record out. A full ring drops records instead of blocking the tracee.
+namespace trace_ring {
+    constexpr uint64_t magic = 0x21676264696e696d; // "minidbg!"
+    constexpr uint32_t version = 1;
+
+    constexpr std::size_t n_records = 1u << 14;
+    constexpr std::size_t max_tracepoints = 256;
+    constexpr std::size_t max_captures = 4;
+    // rax..r15, rip and rflags in the order of enum class reg
+    constexpr std::size_t n_regs = 18;
+    // each tracepoint owns a slot of this size in the jump pad area
+    constexpr std::size_t pad_slot_size = 128;
+    constexpr std::size_t pad_area_size = max_tracepoints * pad_slot_size;
+
+    // memory read by the agent on every hit: base register plus offset, or
+    // an absolute address when base_reg is negative
+    struct capture {
+        int32_t base_reg;
+        uint32_t size;
+        int64_t offset;
+        uint32_t is_signed;
+        uint32_t reserved;
+    };
+
+    struct tracepoint {
+        uint64_t addr;
+        uint32_t n_captures;
+        uint32_t reserved;
+        capture captures[max_captures];
+    };
+
+    struct record {
+        std::atomic<uint64_t> seq; // index + 1 once the record is complete
+        uint32_t tracepoint;
+        uint32_t tid;
+        uint64_t regs[n_regs];
+        uint64_t values[max_captures];
+    };
+
+    struct header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t trampoline; // register saving entry the jump pads call into
+        uint64_t pad_area;   // executable area within rel32 range of the program text
+        uint64_t pad_area_size;
+
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+        std::atomic<uint64_t> dropped;
+
+        tracepoint tracepoints[max_tracepoints];
+        record records[n_records];
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring is shared between processes");
+
+    inline std::string shm_name(pid_t pid) {
+        return "/minidbg-agent-" + std::to_string(pid);
+    }
+}
+
+
+#endif //DEBUGGER_TRACE_RING_H
@@ -0,0 +1,98 @@
+#ifndef DEBUGGER_TRACEPOINTS_H
+#define DEBUGGER_TRACEPOINTS_H
+
+#include <sys/types.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "condition.h"
+#include "target_memory.h"
+#include "trace_ring.h"
+
+// variable recorded on every hit of a tracepoint
+struct trace_capture {
+    std::string name;
+    condition_variable var;
+};
+
+// Fast tracepoints served by the agent preloaded into the tracee. Setting a
+// tracepoint builds a jump pad in the agent's pad area and patches a 5-byte
+// jmp to it, after that hits are recorded into the shared ring without
+// stopping the tracee. A background thread drains the ring while the
+// debugger waits for the tracee.
+class trace_agent {
+public:
+    // nullptr if the tracee does not run the agent
+    static std::unique_ptr<trace_agent> attach(pid_t pid);
+
+    trace_agent(trace_ring::header *ring, std::size_t ring_size);
+
+    ~trace_agent();
+
+    trace_agent(const trace_agent &) = delete;
+
+    trace_agent &operator=(const trace_agent &) = delete;
+
+    // the tracee has to be stopped with its pc outside the patched bytes.
+    // Throws std::runtime_error if the instructions at addr can't be moved.
+    void add(target_memory &memory, std::intptr_t addr, uint64_t pc, std::vector<trace_capture> captures);
+
+    void remove(target_memory &memory, std::intptr_t addr, uint64_t pc);
+
+    // the address of the tracepoint whose jmp or padding covers addr. An int3
+    // there would corrupt the jmp.
+    [[nodiscard]] auto patched_at(std::intptr_t addr) -> std::optional<std::intptr_t>;
+
+    // removes the shared ring of an agent the debugger never attached to
+    static void discard(pid_t pid);
+
+    void print_status(std::ostream &out);
+
+    // the last n records which were drained
+    void print_records(std::ostream &out, std::size_t n);
+
+private:
+    struct tracepoint {
+        std::intptr_t addr;
+        unsigned id;
+        std::vector<uint8_t> original; // bytes replaced by the jmp and its padding
+        std::vector<std::string> names;
+        uint64_t hits{};
+    };
+
+    struct record {
+        unsigned id;
+        uint32_t tid;
+        uint64_t regs[trace_ring::n_regs];
+        uint64_t values[trace_ring::max_captures];
+    };
+
+    static constexpr std::size_t max_kept_records = 4096;
+
+    void drain();
+
+    trace_ring::header *m_ring;
+    std::size_t m_ring_size;
+    unsigned m_next_id{};
+
+    std::mutex m_mutex; // protects the members below against the drain thread
+    std::unordered_map<std::intptr_t, tracepoint> m_tracepoints;
+    std::unordered_map<unsigned, std::intptr_t> m_addr_by_id;
+    std::deque<record> m_records;
+    uint64_t m_drained{};
+
+    std::atomic<bool> m_stop{};
+    std::thread m_drain;
+};
+
+
+#endif //DEBUGGER_TRACEPOINTS_H
@@ -0,0 +1,104 @@
+#ifndef DEBUGGER_TYPE_INDEX_H
+#define DEBUGGER_TYPE_INDEX_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../external/libelfin/dwarf/dwarf++.hh"
+#include "flat_array.h"
+#include "index_cache.h"
+
+// qualified type name -> defining DIE lookup table over the structures,
+// classes, unions and enumerations of all units. Names are qualified by the
+// enclosing namespaces and classes, "outer::ns::point". A unit which only
+// sees a forward declaration (DW_AT_declaration) of a type has no members
+// for it, the definition is in some other unit; finalize() resolves every
+// declaration to the definition with the same qualified name, so looking at
+// a value of a declared type does not have to scan the units.
+//
+// The variables at namespace scope are indexed by their qualified names as
+// well, so the type of a global is found without walking the units either.
+class type_index {
+public:
+    // collects the types of one unit, call finalize() once all are added
+    void add_unit(const dwarf::compilation_unit &cu);
+
+    // takes over the types collected by a shard built on another thread,
+    // declarations are resolved against all units by finalize()
+    void merge(type_index &&shard);
+
+    void finalize();
+
+    // writes the finalized tables to the cache
+    void save(index_cache::writer &out) const;
+
+    // uses the tables saved in the cache in place, instead of add_unit() and
+    // finalize(). Throws index_cache::format_error.
+    void load(index_cache::reader &in);
+
+    // .debug_info offset of a definition of the type with this fully
+    // qualified name. With one definition per unit which uses a type, this
+    // is the first in .debug_info order.
+    [[nodiscard]] auto find(std::string_view qualified_name) const -> std::optional<dwarf::section_offset>;
+
+    // .debug_info offset of the definition of the type declared by the DIE
+    // at this offset, nothing if no unit defines it
+    [[nodiscard]] auto definition_of(dwarf::section_offset declaration) const
+        -> std::optional<dwarf::section_offset>;
+
+    // .debug_info offset of the variable at namespace scope with this fully
+    // qualified name, a definition rather than an extern declaration when
+    // some unit has one
+    [[nodiscard]] auto find_global(std::string_view qualified_name) const -> std::optional<dwarf::section_offset>;
+
+    [[nodiscard]] auto empty() const -> bool;
+
+private:
+    struct entry {
+        std::string name;
+        dwarf::section_offset offset;
+        bool declaration;
+    };
+
+    // names to .debug_info offsets, one per name. The name of entry e is
+    // [begin[e], begin[e + 1]) of chars and slots hashes the names to
+    // entries.
+    struct name_table {
+        flat_array<char> chars{};
+        flat_array<uint32_t> begin{};
+        flat_array<uint64_t> offsets{};
+        flat_array<uint32_t> slots{};
+
+        // keeps the first entry of each name, definitions before
+        // declarations and then in .debug_info order
+        void build(std::vector<entry> &entries);
+
+        void save(index_cache::writer &out) const;
+
+        void load(index_cache::reader &in);
+
+        [[nodiscard]] auto name(uint32_t e) const -> std::string_view;
+
+        [[nodiscard]] auto find(std::string_view wanted) const -> std::optional<dwarf::section_offset>;
+    };
+
+    void add_dies(const dwarf::die &parent, const std::string &scope);
+
+    // collected, cleared by finalize
+    std::vector<entry> m_definitions{};
+    std::vector<entry> m_declarations{};
+    std::vector<entry> m_variables{};
+
+    name_table m_types{};
+    name_table m_globals{};
+
+    // the declarations which some unit defines, sorted by offset, and the
+    // offsets of their definitions
+    flat_array<uint64_t> m_declaration_offsets{};
+    flat_array<uint64_t> m_declaration_definitions{};
+};
+
+
+#endif //DEBUGGER_TYPE_INDEX_H
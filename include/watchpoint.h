@@ -0,0 +1,55 @@
+#ifndef DEBUGGER_WATCHPOINT_H
+#define DEBUGGER_WATCHPOINT_H
+
+#include <sys/types.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+enum class watch_kind {
+    write,  // watch
+    read,   // rwatch, x86 can only trap on read or write so writes hit as well
+    access, // awatch
+};
+
+std::string to_string(watch_kind kind);
+
+struct watchpoint {
+    std::intptr_t addr;
+    std::size_t len;
+    watch_kind kind;
+    uint64_t value; // value at the address when the watchpoint was set or last hit
+};
+
+// Hardware watchpoints programmed into the x86 debug registers. DR0-DR3 hold
+// the watched addresses, DR7 enables them and sets their length and
+// condition, DR6 tells which one fired.
+class hw_watchpoints {
+public:
+    static constexpr unsigned n_slots = 4;
+
+    explicit hw_watchpoints(pid_t pid);
+
+    // returns the slot used, throws std::runtime_error if all slots are taken
+    unsigned add(std::intptr_t addr, std::size_t len, watch_kind kind, uint64_t value);
+
+    void remove(std::intptr_t addr);
+
+    // slot that caused the current stop, if any. Clears DR6.
+    std::optional<unsigned> triggered();
+
+    watchpoint &at(unsigned slot);
+
+private:
+    void poke_debug_register(unsigned index, uint64_t value);
+
+    uint64_t peek_debug_register(unsigned index);
+
+    pid_t m_pid;
+    std::array<std::optional<watchpoint>, n_slots> m_slots{};
+};
+
+
+#endif //DEBUGGER_WATCHPOINT_H
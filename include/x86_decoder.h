@@ -0,0 +1,39 @@
+#ifndef DEBUGGER_X86_DECODER_H
+#define DEBUGGER_X86_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// how an instruction changes the instruction pointer, which decides how the
+// pc has to be fixed up after executing it at another address
+enum class x86_flow {
+    sequential,
+    relative_branch, // jmp/jcc/loop rel8 and rel32
+    relative_call,   // call rel32
+    indirect_branch, // jmp r/m, the target is absolute
+    indirect_call,   // call r/m
+    ret,             // ret, far ret and iret
+    unsupported,     // int3/int/syscall/xbegin and friends, must not be moved
+};
+
+struct x86_instruction {
+    std::size_t length{};
+    x86_flow flow{x86_flow::sequential};
+    // offset of the disp32 of a RIP-relative memory operand, 0 if there is none
+    std::size_t rip_disp_offset{};
+    // size of the displacement of a relative branch or call, it is always
+    // the last field of the instruction
+    std::size_t rel_size{};
+};
+
+constexpr std::size_t x86_max_instruction_length = 15;
+
+// Length decoder for 64-bit mode. It understands the legacy prefixes, REX,
+// VEX, EVEX, the 0F/0F38/0F3A opcode maps and ModRM/SIB addressing, which is
+// enough to copy an instruction elsewhere. Returns nothing for encodings which
+// are invalid in 64-bit mode or longer than size.
+auto decode_x86_instruction(const uint8_t *code, std::size_t size) -> std::optional<x86_instruction>;
+
+
+#endif //DEBUGGER_X86_DECODER_H
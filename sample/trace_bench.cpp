@@ -0,0 +1,33 @@
+//
+// Hit rate of a function under the debugger. Run it with an int3 breakpoint
+// whose condition never holds, so every hit is a full stop and resume:
+//
+//   printf 'break hot if 0\ncont\ninfo\n' | debugger trace_bench
+//
+// and with a fast tracepoint served by the preloaded agent, which is
+// initialised by the time main runs:
+//
+//   printf 'break main\ncont\ntrace hot id\ncont\ntstatus\n' | debugger --agent libdebugger_agent.so trace_bench
+//
+
+#include <chrono>
+#include <cstdio>
+
+constexpr int n_calls = 200000;
+
+long total = 0;
+
+void hot(int id) {
+    total += id;
+}
+
+int main() {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_calls; ++i) {
+        hot(i);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::printf("%d calls in %.3f s, %.0f calls/s (total %ld)\n",
+                n_calls, elapsed.count(), n_calls / elapsed.count(), total);
+}
@@ -1,23 +1,18 @@
-#include <sys/ptrace.h>
-#include <zconf.h>
+
 #include "../include/breakpoint.h"
 
-breakpoint::breakpoint(pid_t pid, std::intptr_t addr) {
+breakpoint::breakpoint(target_memory &memory, std::intptr_t addr) : m_memory{&memory}, m_addr{addr} {
 }
 
 void breakpoint::enable() {
-    long int data = ptrace(PTRACE_PEEKDATA, m_pid, m_addr, nullptr);
-    m_saved_data = static_cast<uint8_t>(data & 0xff); // save bottom byte
-    uint64_t int3 = 0xcc;
-    uint64_t data_with_int3 = ((data & ~0xff) | int3); // set bottom byte to 0xcc
-    ptrace(PTRACE_POKEDATA, m_pid, m_addr, data_with_int3);
+    m_saved_data = m_memory->read_byte(m_addr); // save the byte we are going to replace
+    uint8_t int3 = 0xcc;
+    m_memory->write(m_addr, &int3, sizeof(int3));
     m_enabled = true;
 }
 
 void breakpoint::disable() {
-    long int data = ptrace(PTRACE_PEEKDATA, m_pid, m_addr, nullptr);
-    auto restored_data = ((data & ~0xff) | m_saved_data);
-    ptrace(PTRACE_POKEDATA, m_pid, m_addr, restored_data);
+    m_memory->write(m_addr, &m_saved_data, sizeof(m_saved_data));
     m_enabled = false;
 }
 
@@ -29,3 +24,6 @@ auto breakpoint::get_address() const -> std::intptr_t {
     return m_addr;
 }
 
+auto breakpoint::get_saved_data() const -> uint8_t {
+    return m_saved_data;
+}
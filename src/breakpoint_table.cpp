@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <stdexcept>
+#include "../include/breakpoint_table.h"
+
+namespace {
+    constexpr std::size_t initial_capacity = 64;
+    constexpr std::size_t word_size = sizeof(uint64_t);
+    constexpr uint8_t int3 = 0xcc;
+
+    // Fibonacci hashing, code addresses share their high bits so the
+    // multiplication is needed to spread them over the table
+    std::size_t hash_address(std::intptr_t addr) {
+        return static_cast<std::size_t>((static_cast<uint64_t>(addr) * 0x9e3779b97f4a7c15ull) >> 32);
+    }
+}
+
+breakpoint_table::breakpoint_table(target_memory &memory) : m_memory{&memory}, m_slots(initial_capacity) {
+}
+
+// index of the slot holding addr, or m_slots.size() when it is absent
+auto breakpoint_table::index_of(std::intptr_t addr) const -> std::size_t {
+    auto mask = m_slots.size() - 1;
+    for (auto i = hash_address(addr) & mask;; i = (i + 1) & mask) {
+        const auto &s = m_slots[i];
+        if (s.state == slot_state::empty) {
+            return m_slots.size();
+        }
+        if (s.state == slot_state::used && s.addr == addr) {
+            return i;
+        }
+    }
+}
+
+auto breakpoint_table::contains(std::intptr_t addr) const -> bool {
+    return index_of(addr) != m_slots.size();
+}
+
+auto breakpoint_table::find(std::intptr_t addr) -> breakpoint * {
+    auto i = index_of(addr);
+    return i == m_slots.size() ? nullptr : &m_slots[i].bp;
+}
+
+// slot for a new entry at addr, which must not be in the table yet
+auto breakpoint_table::claim(std::intptr_t addr) -> slot & {
+    // keep the load including tombstones below 3/4 so probes terminate quickly
+    if ((m_used + 1) * 4 > m_slots.size() * 3) {
+        grow();
+    }
+
+    auto mask = m_slots.size() - 1;
+    auto i = hash_address(addr) & mask;
+    while (m_slots[i].state == slot_state::used) {
+        i = (i + 1) & mask;
+    }
+
+    auto &s = m_slots[i];
+    if (s.state == slot_state::empty) {
+        ++m_used;
+    }
+    ++m_size;
+    s.addr = addr;
+    s.state = slot_state::used;
+    s.bp = breakpoint{*m_memory, addr};
+    return s;
+}
+
+void breakpoint_table::grow() {
+    auto capacity = m_slots.size();
+    // only rehash in place when most of the load is tombstones
+    if (m_size * 2 >= capacity) {
+        capacity *= 2;
+    }
+
+    std::vector<slot> old(capacity);
+    old.swap(m_slots);
+    m_size = 0;
+    m_used = 0;
+
+    auto mask = m_slots.size() - 1;
+    for (auto &s: old) {
+        if (s.state != slot_state::used) {
+            continue;
+        }
+        auto i = hash_address(s.addr) & mask;
+        while (m_slots[i].state == slot_state::used) {
+            i = (i + 1) & mask;
+        }
+        m_slots[i] = s;
+        ++m_size;
+        ++m_used;
+    }
+}
+
+auto breakpoint_table::insert(std::intptr_t addr) -> breakpoint & {
+    if (auto *bp = find(addr)) {
+        return *bp;
+    }
+    auto &bp = claim(addr).bp;
+    try {
+        bp.enable();
+    } catch (...) {
+        erase(addr);
+        throw;
+    }
+    return bp;
+}
+
+void breakpoint_table::erase(std::intptr_t addr) {
+    auto i = index_of(addr);
+    if (i == m_slots.size()) {
+        return;
+    }
+    auto &s = m_slots[i];
+    if (s.bp.is_enabled()) {
+        s.bp.disable();
+    }
+    s.bp = breakpoint{};
+    s.state = slot_state::deleted;
+    --m_size;
+}
+
+auto breakpoint_table::insert_batch(std::vector<std::intptr_t> addrs) -> std::vector<std::intptr_t> {
+    std::sort(addrs.begin(), addrs.end());
+    addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+    addrs.erase(std::remove_if(addrs.begin(), addrs.end(), [this](auto addr) { return contains(addr); }),
+                addrs.end());
+
+    for (auto addr: addrs) {
+        claim(addr);
+    }
+    try {
+        patch(addrs, true);
+    } catch (...) {
+        // patch left none of them armed
+        for (auto addr: addrs) {
+            erase(addr);
+        }
+        throw;
+    }
+    return addrs;
+}
+
+void breakpoint_table::erase_batch(const std::vector<std::intptr_t> &addrs) {
+    std::vector<std::intptr_t> enabled{};
+    for (auto addr: addrs) {
+        auto *bp = find(addr);
+        if (bp && bp->is_enabled()) {
+            enabled.push_back(addr);
+        }
+    }
+    std::sort(enabled.begin(), enabled.end());
+    enabled.erase(std::unique(enabled.begin(), enabled.end()), enabled.end());
+    patch(enabled, false);
+
+    // the breakpoints are disabled now, so erase only drops the slots
+    for (auto addr: addrs) {
+        erase(addr);
+    }
+}
+
+// arms or disarms the breakpoints at the sorted addresses. Every run of
+// adjacent aligned words is read once from the page cache, patched in a local
+// buffer and written back with a single write. When a write fails, the runs
+// written before it are restored and the breakpoints keep their state.
+void breakpoint_table::patch(std::vector<std::intptr_t> addrs, bool arm) {
+    struct run {
+        uint64_t first;
+        std::vector<uint8_t> original;
+    };
+    std::vector<run> written{};
+    std::vector<uint8_t> buffer{};
+    std::size_t i = 0;
+    try {
+        while (i < addrs.size()) {
+            auto first = static_cast<uint64_t>(addrs[i]) & ~(word_size - 1);
+            auto last = first;
+            auto j = i;
+            while (j < addrs.size() && (static_cast<uint64_t>(addrs[j]) & ~(word_size - 1)) <= last + word_size) {
+                last = static_cast<uint64_t>(addrs[j]) & ~(word_size - 1);
+                ++j;
+            }
+
+            buffer.resize(last + word_size - first);
+            m_memory->read(first, buffer.data(), buffer.size());
+            auto original = buffer;
+            for (auto k = i; k < j; ++k) {
+                buffer[addrs[k] - first] = arm ? int3 : find(addrs[k])->m_saved_data;
+            }
+            m_memory->write(first, buffer.data(), buffer.size());
+            written.push_back({first, std::move(original)});
+
+            for (auto k = i; k < j; ++k) {
+                auto &bp = *find(addrs[k]);
+                if (arm) {
+                    bp.m_saved_data = written.back().original[addrs[k] - first];
+                }
+                bp.m_enabled = arm;
+            }
+            i = j;
+        }
+    } catch (...) {
+        for (auto it = written.rbegin(); it != written.rend(); ++it) {
+            try {
+                m_memory->write(it->first, it->original.data(), it->original.size());
+            } catch (std::runtime_error &) {
+                // it was writable a moment ago, nothing more can be done
+            }
+        }
+        for (std::size_t k = 0; k < i; ++k) {
+            find(addrs[k])->m_enabled = !arm;
+        }
+        throw;
+    }
+}
+
+auto breakpoint_table::size() const -> std::size_t {
+    return m_size;
+}
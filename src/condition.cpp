@@ -0,0 +1,283 @@
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include "../include/condition.h"
+
+namespace {
+    // binary operators by precedence level, loosest first, as in C
+    struct binary_operator {
+        const char *token;
+        int level;
+        cond_op op;
+    };
+
+    constexpr binary_operator binary_operators[] = {
+            {"||", 0, cond_op::jump_true},
+            {"&&", 1, cond_op::jump_false},
+            {"|",  2, cond_op::bor},
+            {"^",  3, cond_op::bxor},
+            {"&",  4, cond_op::band},
+            {"==", 5, cond_op::eq},
+            {"!=", 5, cond_op::ne},
+            {"<=", 6, cond_op::le},
+            {">=", 6, cond_op::ge},
+            {"<<", 7, cond_op::shl},
+            {">>", 7, cond_op::shr},
+            {"<",  6, cond_op::lt},
+            {">",  6, cond_op::gt},
+            {"+",  8, cond_op::add},
+            {"-",  8, cond_op::sub},
+            {"*",  9, cond_op::mul},
+            {"/",  9, cond_op::div},
+            {"%",  9, cond_op::mod},
+    };
+    constexpr int max_level = 9;
+
+    class compiler {
+    public:
+        compiler(const std::string &text, const condition::resolver &resolve) : m_text{text}, m_resolve{resolve} {
+        }
+
+        std::vector<cond_insn> compile() {
+            binary(0);
+            skip_space();
+            if (m_pos != m_text.size()) {
+                fail("unexpected '" + m_text.substr(m_pos) + "'");
+            }
+            return std::move(m_code);
+        }
+
+    private:
+        [[noreturn]] void fail(const std::string &what) {
+            throw std::invalid_argument{"bad condition: " + what};
+        }
+
+        void skip_space() {
+            while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+                ++m_pos;
+            }
+        }
+
+        bool accept(const char *token) {
+            skip_space();
+            auto len = std::char_traits<char>::length(token);
+            if (m_text.compare(m_pos, len, token) != 0) {
+                return false;
+            }
+            m_pos += len;
+            return true;
+        }
+
+        void emit(cond_op op, uint64_t operand = 0, int stack_effect = 0) {
+            m_code.push_back({op, operand});
+            m_depth += stack_effect;
+            if (m_depth > static_cast<int>(condition::max_stack)) {
+                fail("expression too deep");
+            }
+        }
+
+        const binary_operator *peek_operator(int level) {
+            skip_space();
+            for (const auto &bo: binary_operators) {
+                auto len = std::char_traits<char>::length(bo.token);
+                if (bo.level == level && m_text.compare(m_pos, len, bo.token) == 0) {
+                    // don't take the first half of a longer operator, e.g. & of &&
+                    auto next = m_pos + len < m_text.size() ? m_text[m_pos + len] : '\0';
+                    if (len == 1 && std::strchr("&|<>", bo.token[0]) && (next == bo.token[0] || next == '=')) {
+                        continue;
+                    }
+                    return &bo;
+                }
+            }
+            return nullptr;
+        }
+
+        void binary(int level) {
+            if (level > max_level) {
+                unary();
+                return;
+            }
+            binary(level + 1);
+            while (auto *bo = peek_operator(level)) {
+                m_pos += std::char_traits<char>::length(bo->token);
+                if (bo->op == cond_op::jump_false || bo->op == cond_op::jump_true) {
+                    auto jump = m_code.size();
+                    emit(bo->op, 0, -1);
+                    binary(level + 1);
+                    emit(cond_op::to_bool);
+                    m_code[jump].operand = m_code.size();
+                } else {
+                    binary(level + 1);
+                    emit(bo->op, 0, -1);
+                }
+            }
+        }
+
+        void unary() {
+            if (accept("!")) {
+                unary();
+                emit(cond_op::lnot);
+            } else if (accept("-")) {
+                unary();
+                emit(cond_op::neg);
+            } else if (accept("~")) {
+                unary();
+                emit(cond_op::bnot);
+            } else if (accept("*")) {
+                unary();
+                emit(cond_op::load, sizeof(uint64_t));
+            } else {
+                primary();
+            }
+        }
+
+        void primary() {
+            skip_space();
+            if (accept("(")) {
+                binary(0);
+                if (!accept(")")) {
+                    fail("missing ')'");
+                }
+                return;
+            }
+            if (m_pos >= m_text.size()) {
+                fail("unexpected end");
+            }
+
+            auto c = m_text[m_pos];
+            if (std::isdigit(static_cast<unsigned char>(c))) {
+                std::size_t used = 0;
+                auto value = std::stoull(m_text.substr(m_pos), &used, 0);
+                m_pos += used;
+                emit(cond_op::push_const, value, 1);
+                return;
+            }
+
+            auto start = m_pos;
+            if (c == '$') {
+                ++m_pos;
+            }
+            while (m_pos < m_text.size() &&
+                   (std::isalnum(static_cast<unsigned char>(m_text[m_pos])) || m_text[m_pos] == '_')) {
+                ++m_pos;
+            }
+            auto name = m_text.substr(start, m_pos - start);
+            if (name.empty() || name == "$") {
+                fail("unexpected '" + m_text.substr(start) + "'");
+            }
+
+            if (name[0] == '$') {
+                try {
+                    emit(cond_op::push_reg, static_cast<uint64_t>(get_register_from_name(name.substr(1))), 1);
+                } catch (std::out_of_range &) {
+                    fail("unknown register " + name);
+                }
+                return;
+            }
+
+            auto var = m_resolve(name);
+            if (!var) {
+                fail("no variable " + name + " in scope");
+            }
+            if (var->base) {
+                emit(cond_op::push_reg, static_cast<uint64_t>(*var->base), 1);
+                emit(cond_op::push_const, static_cast<uint64_t>(var->offset), 1);
+                emit(cond_op::add, 0, -1);
+            } else {
+                emit(cond_op::push_const, static_cast<uint64_t>(var->offset), 1);
+            }
+            emit(cond_op::load, var->size | (var->is_signed ? 0x100 : 0));
+        }
+
+        const std::string &m_text;
+        const condition::resolver &m_resolve;
+        std::size_t m_pos{};
+        int m_depth{};
+        std::vector<cond_insn> m_code{};
+    };
+
+    uint64_t load(target_memory &memory, uint64_t address, uint64_t operand) {
+        auto size = operand & 0xff;
+        uint64_t value = 0;
+        memory.read(address, &value, size);
+        if ((operand & 0x100) && size < sizeof(value)) {
+            auto shift = 64 - 8 * size;
+            value = static_cast<uint64_t>(static_cast<int64_t>(value << shift) >> shift);
+        }
+        return value;
+    }
+}
+
+condition::condition(std::string text, const resolver &resolve) : m_text{std::move(text)} {
+    m_code = compiler{m_text, resolve}.compile();
+}
+
+auto condition::evaluate(register_cache &regs, target_memory &memory) const -> uint64_t {
+    uint64_t stack[max_stack];
+    std::size_t sp = 0;
+
+    for (std::size_t pc = 0; pc < m_code.size(); ++pc) {
+        const auto &insn = m_code[pc];
+        // binary operators work on b (top) and a (below it) and leave the result in a
+        auto &a = stack[sp >= 2 ? sp - 2 : 0];
+        auto b = sp ? stack[sp - 1] : 0;
+        auto sa = static_cast<int64_t>(a);
+        auto sb = static_cast<int64_t>(b);
+
+        switch (insn.op) {
+            case cond_op::push_const:
+                stack[sp++] = insn.operand;
+                continue;
+            case cond_op::push_reg:
+                stack[sp++] = get_register_value(regs, static_cast<reg>(insn.operand));
+                continue;
+            case cond_op::load:
+                stack[sp - 1] = load(memory, b, insn.operand);
+                continue;
+            case cond_op::lnot:
+                stack[sp - 1] = !b;
+                continue;
+            case cond_op::neg:
+                stack[sp - 1] = -b;
+                continue;
+            case cond_op::bnot:
+                stack[sp - 1] = ~b;
+                continue;
+            case cond_op::to_bool:
+                stack[sp - 1] = b != 0;
+                continue;
+            case cond_op::jump_false:
+            case cond_op::jump_true:
+                if ((b != 0) == (insn.op == cond_op::jump_true)) {
+                    stack[sp - 1] = b != 0;
+                    pc = insn.operand - 1;
+                } else {
+                    --sp;
+                }
+                continue;
+            case cond_op::add: a += b; break;
+            case cond_op::sub: a -= b; break;
+            case cond_op::mul: a *= b; break;
+            // INT64_MIN / -1 traps like division by zero, negating wraps
+            case cond_op::div: a = sb == -1 ? 0 - a : sb ? static_cast<uint64_t>(sa / sb) : 0; break;
+            case cond_op::mod: a = sb == -1 || !sb ? 0 : static_cast<uint64_t>(sa % sb); break;
+            case cond_op::band: a &= b; break;
+            case cond_op::bor: a |= b; break;
+            case cond_op::bxor: a ^= b; break;
+            case cond_op::shl: a = b < 64 ? a << b : 0; break;
+            case cond_op::shr: a = b < 64 ? static_cast<uint64_t>(sa >> b) : 0; break;
+            case cond_op::eq: a = a == b; break;
+            case cond_op::ne: a = a != b; break;
+            case cond_op::lt: a = sa < sb; break;
+            case cond_op::le: a = sa <= sb; break;
+            case cond_op::gt: a = sa > sb; break;
+            case cond_op::ge: a = sa >= sb; break;
+        }
+        --sp;
+    }
+    return sp ? stack[sp - 1] : 0;
+}
+
+auto condition::text() const -> const std::string & {
+    return m_text;
+}
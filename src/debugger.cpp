@@ -4,11 +4,32 @@
 #include <iostream>
 #include <sys/ptrace.h>
 #include <wait.h>
-#include <registers.h>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+#include <climits>
+#include <array>
+#include <algorithm>
+#include <mutex>
 #include "linenoise.h"
 
+namespace {
+    std::string to_hex(uint64_t value) {
+        std::stringstream ss{};
+        ss << std::hex << value;
+        return ss.str();
+    }
+
+    // file:line, as opposed to a qualified function name like ns::add
+    bool is_source_location(const std::string &location) {
+        auto colon = location.rfind(':');
+        return colon != std::string::npos && colon > 0 && location[colon - 1] != ':' &&
+               colon + 1 < location.size() &&
+               location.find_first_not_of("0123456789", colon + 1) == std::string::npos;
+    }
+}
+
 std::string to_string(symbol_type st) {
     switch (st) {
         case symbol_type::notype:
@@ -54,6 +75,10 @@ void debugger::run() {
         linenoiseHistoryAdd(line);
         linenoiseFree(line);
     }
+
+    if (!m_agent) {
+        trace_agent::discard(m_pid);
+    }
 }
 
 void debugger::handle_command(const std::string &line) {
@@ -63,15 +88,49 @@ void debugger::handle_command(const std::string &line) {
     if (is_prefix(command, "cont")) {
         continue_execution();
     } else if (is_prefix(command, "break")) {
+        std::vector<std::intptr_t> addrs{};
         if (args[1][0] == '0' && args[1][1] == 'x') {
             std::string addr{args[1], 2};
-            set_breakpoint_at_address(std::stol(addr, 0, 16));
-        } else if (args[1].find(':') != std::string::npos) {
+            addrs.push_back(std::stol(addr, 0, 16));
+            set_breakpoint_at_address(addrs.back());
+        } else if (is_source_location(args[1])) {
             auto file_and_line = split(args[1], ':');
-            set_breakpoint_at_source_line(file_and_line[0], std::stoi(file_and_line[1]));
+            addrs = set_breakpoint_at_source_line(file_and_line[0], std::stoi(file_and_line[1]));
+        } else {
+            addrs = set_breakpoint_at_function(args[1]);
+        }
+
+        // break <location> if <expression>
+        if (args.size() > 3 && args[2] == "if") {
+            auto expr = line.substr(line.find(" if ") + 4);
+            for (auto addr: addrs) {
+                set_breakpoint_condition(addr, expr);
+            }
+        }
+    } else if (command == "trace") {
+        set_tracepoint(args[1], {args.begin() + 2, args.end()});
+    } else if (command == "untrace") {
+        std::string addr{args[1], 2}; //assume 0xADDRESS
+        remove_tracepoint(std::stol(addr, 0, 16));
+    } else if (command == "tstatus" || command == "tdump") {
+        if (!m_agent) {
+            std::cerr << "No tracepoints" << std::endl;
+        } else if (command == "tstatus") {
+            m_agent->print_status(std::cout);
         } else {
-            set_breakpoint_at_function(args[1]);
+            m_agent->print_records(std::cout, args.size() > 1 ? std::stoul(args[1]) : 10);
         }
+    } else if (is_prefix(command, "info")) {
+        dump_breakpoint_conditions();
+    } else if (command == "watch" || command == "rwatch" || command == "awatch") {
+        std::string addr{args[1], 2}; //assume 0xADDRESS
+        auto len = args.size() > 2 ? std::stoul(args[2], 0, 0) : sizeof(uint64_t);
+        auto kind = command == "watch" ? watch_kind::write
+                                       : command == "rwatch" ? watch_kind::read : watch_kind::access;
+        set_watchpoint(std::stol(addr, 0, 16), len, kind);
+    } else if (command == "unwatch") {
+        std::string addr{args[1], 2}; //assume 0xADDRESS
+        remove_watchpoint(std::stol(addr, 0, 16));
     } else if (is_prefix(command, "step")) {
         step_in();
     } else if (is_prefix(command, "next")) {
@@ -79,14 +138,33 @@ void debugger::handle_command(const std::string &line) {
     } else if (is_prefix(command, "finish")) {
         step_out();
     } else if (is_prefix(command, "register")) {
-        if (is_prefix(args[1], "dump")) {
-            dump_registers();
+        // unknown names and writes to registers outside the general purpose
+        // bank are reported, they don't end the session
+        try {
+            if (is_prefix(args[1], "dump")) {
+                dump_registers();
+            } else if (is_prefix(args[1], "read")) {
+                auto r = get_register_from_name(args[2]);
+                if (get_register_descriptor(r).bank == reg_bank::gpr) {
+                    std::cout << get_register_value(registers(), r) << std::endl;
+                } else {
+                    // most significant byte first
+                    auto bytes = get_register_bytes(registers(), r);
+                    std::cout << "0x";
+                    for (auto it = bytes.rbegin(); it != bytes.rend(); ++it) {
+                        std::cout << std::setfill('0') << std::setw(2) << std::hex << static_cast<unsigned>(*it);
+                    }
+                    std::cout << std::endl;
+                }
+            } else if (is_prefix(args[1], "write")) {
+                std::string val{args[3], 2}; //assume 0xVAL
+                set_register_value(registers(), get_register_from_name(args[2]), std::stol(val, 0, 16));
+            }
+        } catch (std::out_of_range &e) {
+            std::cerr << "Cannot access register: " << e.what() << std::endl;
+        } catch (std::invalid_argument &e) {
+            std::cerr << "Cannot access register: " << e.what() << std::endl;
         }
-    } else if (is_prefix(args[1], "read")) {
-        std::cout << get_register_value(m_pid, get_register_from_name(args[2])) << std::endl;
-    } else if (is_prefix(args[1], "write")) {
-        std::string val{args[3], 2}; //assume 0xVAL
-        set_register_value(m_pid, get_register_from_name(args[2]), std::stol(val, 0, 16));
     } else if (is_prefix(command, "memory")) {
         std::string addr{args[2], 2}; //assume 0xADDRESS
 
@@ -94,8 +172,28 @@ void debugger::handle_command(const std::string &line) {
             std::cout << std::hex << read_memory(std::stol(addr, 0, 16)) << std::endl;
         }
         if (is_prefix(args[1], "write")) {
-            std::string val{args[3], 2}; //assume 0xVAL
-            write_memory(std::stol(addr, 0, 16), std::stol(val, 0, 16));
+            // consecutive words are written with a single call
+            std::vector<uint64_t> words{};
+            for (std::size_t i = 3; i < args.size(); ++i) {
+                std::string val{args[i], 2}; //assume 0xVAL
+                words.push_back(std::stoul(val, 0, 16));
+            }
+            try {
+                write_memory(std::stol(addr, 0, 16), words.data(), words.size() * sizeof(uint64_t));
+            } catch (std::runtime_error &e) {
+                std::cerr << "Cannot write memory: " << e.what() << std::endl;
+            }
+        }
+        if (is_prefix(args[1], "dump")) {
+            dump_memory(std::stol(addr, 0, 16), std::stoul(args[3], 0, 0));
+        }
+    } else if (command == "type") {
+        try {
+            print_type(args[1]);
+        } catch (dwarf::value_type_mismatch &e) {
+            std::cerr << "Cannot print type: " << e.what() << std::endl;
+        } catch (std::out_of_range &e) {
+            std::cerr << "Cannot print type: " << e.what() << std::endl;
         }
     } else if (is_prefix(command, "symbol")) {
         auto syms = lookup_symbol(args[1]);
@@ -131,57 +229,188 @@ bool debugger::is_prefix(const std::string &s, const std::string &of) {
 }
 
 void debugger::continue_execution() {
-    step_over_breakpoint();
-    ptrace(PTRACE_CONT, m_pid, nullptr, nullptr);
-    wait_for_signal();
+    // hits of conditional breakpoints whose condition is false resume right away
+    do {
+        m_resume_after_stop = false;
+        step_over_breakpoint();
+        resume(PTRACE_CONT);
+        wait_for_signal();
+    } while (m_resume_after_stop);
+}
+
+register_cache &debugger::registers(pid_t tid) {
+    return m_registers.try_emplace(tid, tid).first->second;
+}
+
+register_cache &debugger::registers() {
+    return registers(m_pid);
+}
+
+// every PTRACE_CONT/PTRACE_SINGLESTEP goes through here, so the register
+// writes are flushed and the per-stop caches are dropped before the tracee runs
+void debugger::resume(__ptrace_request request) {
+    for (auto &[tid, regs]: m_registers) {
+        regs.flush();
+        regs.invalidate();
+    }
+    m_memory.invalidate();
+    ptrace(request, m_pid, nullptr, nullptr);
 }
 
 void debugger::set_breakpoint_at_address(std::intptr_t addr) {
-    std::cout << "Set breakpoint at address 0x" << std::hex << addr << std::endl;
-    breakpoint bp{m_pid, addr};
-    bp.enable();
-    m_breakpoints.insert(std::make_pair(addr, bp));
+    if (auto tracepoint = patched_by_tracepoint(addr)) {
+        std::cerr << "Cannot set breakpoint: 0x" << std::hex << addr << " is patched by the tracepoint at 0x"
+                  << *tracepoint << std::endl;
+        return;
+    }
+    try {
+        m_breakpoints.insert(addr);
+        std::cout << "Set breakpoint at address 0x" << std::hex << addr << std::endl;
+    } catch (std::runtime_error &e) {
+        std::cerr << "Cannot set breakpoint: " << e.what() << std::endl;
+    }
 }
 
 void debugger::dump_registers() {
     for (const auto &rd:g_registers_descriptors) {
+        // vector and x87 registers live in the XSAVE area, which is only
+        // fetched when one of them is read explicitly
+        if (rd.bank != reg_bank::gpr) {
+            continue;
+        }
         std::cout
                 << rd.name
                 << "0x"
                 << std::setfill('0')
                 << std::setw(16)
                 << std::hex
-                << get_register_value(m_pid, rd.r)
+                << get_register_value(registers(), rd.r)
                 << std::endl;
     }
 }
 
 uint64_t debugger::read_memory(uint64_t address) {
-    return ptrace(PTRACE_PEEKDATA, m_pid, address, nullptr);
+    return m_memory.read_word(address);
+}
+
+void debugger::read_memory(uint64_t address, void *buffer, std::size_t length) {
+    m_memory.read(address, buffer, length);
 }
 
 void debugger::write_memory(uint64_t address, uint64_t value) {
-    ptrace(PTRACE_POKEDATA, m_pid, address, value);
+    m_memory.write_word(address, value);
+}
+
+void debugger::write_memory(uint64_t address, const void *buffer, std::size_t length) {
+    m_memory.write(address, buffer, length);
+}
+
+// hexdump of the tracee memory, 16 bytes per line
+void debugger::dump_memory(uint64_t address, std::size_t length) {
+    std::vector<uint8_t> data(length);
+    read_memory(address, data.data(), data.size());
+
+    for (std::size_t off = 0; off < data.size(); off += 16) {
+        std::cout << "0x" << std::setfill('0') << std::setw(16) << std::hex << address + off << ':';
+        for (std::size_t i = off; i < std::min(off + 16, data.size()); ++i) {
+            std::cout << ' ' << std::setw(2) << static_cast<unsigned>(data[i]);
+        }
+        std::cout << std::endl;
+    }
 }
 
 uint64_t debugger::get_pc() {
-    return get_register_value(m_pid, reg::rip);
+    return get_register_value(registers(), reg::rip);
 }
 
 void debugger::set_pc(uint64_t pc) {
-    set_register_value(m_pid, reg::rip, pc);
+    set_register_value(registers(), reg::rip, pc);
 }
 
 void debugger::step_over_breakpoint() {
-    if (m_breakpoints.count(get_pc())) {
-        auto &bp = m_breakpoints[get_pc()];
-        if (bp.is_enabled()) {
-            bp.disable();
-            ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
-            wait_for_signal();
-            bp.enable();
+    auto *bp = m_breakpoints.find(get_pc());
+    if (bp && bp->is_enabled() && !displaced_step(*bp)) {
+        bp->disable();
+        resume(PTRACE_SINGLESTEP);
+        wait_for_signal();
+        bp->enable();
+    }
+}
+
+// Executes the instruction under the breakpoint from a scratch area instead
+// of taking the int3 out for a single step, so the breakpoint stays armed the
+// whole time. The scratch area is the ELF entry point: _start has run long
+// before any breakpoint is stepped over and never runs again.
+//
+// Returns false when the instruction cannot be moved, the caller falls back
+// to disable/step/enable then.
+bool debugger::displaced_step(const breakpoint &bp) {
+    auto pc = static_cast<uint64_t>(bp.get_address());
+    auto scratch = m_elf.get_hdr().entry;
+    if (pc < scratch + x86_max_instruction_length && scratch < pc + x86_max_instruction_length) {
+        return false;
+    }
+
+    std::array<uint8_t, x86_max_instruction_length> code{};
+    read_memory(pc, code.data(), code.size());
+    code[0] = bp.get_saved_data();
+    auto insn = decode_x86_instruction(code.data(), code.size());
+    if (!insn || insn->flow == x86_flow::unsupported) {
+        return false;
+    }
+
+    for (std::size_t i = 0; i < x86_max_instruction_length; ++i) {
+        if (i > 0 && i < insn->length) {
+            if (auto *other = m_breakpoints.find(pc + i); other && other->is_enabled()) {
+                code[i] = other->get_saved_data();
+            }
+        }
+        // the breakpoint would be overwritten by the copy
+        if (m_breakpoints.contains(scratch + i)) {
+            return false;
         }
     }
+
+    // RIP-relative operands have to point at the same data from the scratch area
+    if (insn->rip_disp_offset) {
+        int32_t disp{};
+        std::memcpy(&disp, code.data() + insn->rip_disp_offset, sizeof(disp));
+        auto fixed = disp + static_cast<int64_t>(pc - scratch);
+        if (fixed < INT32_MIN || fixed > INT32_MAX) {
+            return false;
+        }
+        disp = static_cast<int32_t>(fixed);
+        std::memcpy(code.data() + insn->rip_disp_offset, &disp, sizeof(disp));
+    }
+
+    std::array<uint8_t, x86_max_instruction_length> saved{};
+    read_memory(scratch, saved.data(), insn->length);
+    write_memory(scratch, code.data(), insn->length);
+    set_pc(scratch);
+
+    resume(PTRACE_SINGLESTEP);
+    int wait_status;
+    waitpid(m_pid, &wait_status, 0);
+    write_memory(scratch, saved.data(), insn->length);
+
+    // relative targets and the fall through address moved along with the
+    // instruction, absolute targets did not. A step interrupted before the
+    // instruction ran leaves the pc at the start of the scratch area.
+    auto rip = get_pc();
+    if (rip == scratch) {
+        set_pc(pc);
+    } else {
+        auto flow = insn->flow;
+        if (flow == x86_flow::relative_call || flow == x86_flow::indirect_call) {
+            write_memory(get_register_value(registers(), reg::rsp), pc + insn->length);
+        }
+        if (flow == x86_flow::sequential || flow == x86_flow::relative_branch || flow == x86_flow::relative_call) {
+            set_pc(rip - scratch + pc);
+        }
+    }
+
+    handle_signal(get_signal_info());
+    return true;
 }
 
 // encapsulate waitpid syscall
@@ -190,7 +419,15 @@ void debugger::wait_for_signal() {
     auto options = 0;
     waitpid(m_pid, &wait_status, options);
 
-    auto siginfo = get_signal_info();
+    if (WIFEXITED(wait_status)) {
+        std::cout << "Process exited with status " << std::dec << WEXITSTATUS(wait_status) << std::endl;
+        return;
+    }
+
+    handle_signal(get_signal_info());
+}
+
+void debugger::handle_signal(siginfo_t siginfo) {
     switch (siginfo.si_signo) {
         case SIGTRAP:
             handle_sigtrap(siginfo);
@@ -201,40 +438,140 @@ void debugger::wait_for_signal() {
         default:
             std::cout << "Got signal " << strsignal(siginfo.si_signo) << std::endl;
     }
-
 }
 
 // debugging information entry (DIE)
 dwarf::die debugger::get_function_from_pc(uint64_t pc) {
-    for (auto &cu: m_dwarf.compilation_units()) {
-        if (die_pc_range(cu.root()).contains(pc)) {
-            for (const auto &die: cu.root()) {
-                if (die.tag == dwarf::DW_TAG::subprogram) {
-                    if (die_pc_range(die).contains(pc)) {
-                        return die;
-                    }
-                }
+    auto offset = m_pc_index.function_at(pc);
+    if (!offset) {
+        throw std::out_of_range{"cannot find function"};
+    }
+    return m_dwarf.get_die(*offset);
+}
+
+// Loads the indexes from the cache kept for this build of the binary, or
+// walks the DIEs and line tables of all compilation units once, on a thread
+// per core, and caches the result. Every worker fills its own shard of each
+// index, the shards are merged once all units are done.
+void debugger::build_indexes() {
+    std::size_t build_id_size = 0;
+    auto build_id_data = m_elf.get_note("GNU", elf::nt::gnu_build_id, &build_id_size);
+    std::string_view build_id{};
+    if (build_id_data) {
+        build_id = {static_cast<const char *>(build_id_data), build_id_size};
+    }
+    std::string_view image{static_cast<const char *>(m_elf.get_loader()->load(0, m_image_size)), m_image_size};
+    // without a build ID there is no telling whether a cache is stale
+    auto cache_path = build_id.empty() ? std::string{} : index_cache::path_for(build_id);
+    if (load_cached_indexes(cache_path, build_id, image)) {
+        return;
+    }
+
+    const auto &cus = m_dwarf.compilation_units();
+    thread_pool pool{std::min<std::size_t>(std::thread::hardware_concurrency(), std::max<std::size_t>(cus.size(), 1))};
+
+    // a unit whose DWARF can't be read is left out of all indexes and the
+    // others still work. It may have added to its worker's shards before it
+    // failed, so the shards are built again without it, which costs nothing
+    // as long as every unit can be read.
+    std::vector<uint8_t> skip(cus.size(), false);
+    std::vector<std::pair<dwarf::section_offset, std::string>> skipped{};
+    std::mutex skipped_mutex;
+    std::vector<pc_index> pc_shards{};
+    std::vector<line_index> line_shards{};
+    std::vector<function_index> function_shards{};
+    std::vector<type_index> type_shards{};
+    for (std::size_t n_skipped = 0;; n_skipped = skipped.size()) {
+        pc_shards = std::vector<pc_index>(pool.size());
+        line_shards = std::vector<line_index>(pool.size());
+        function_shards = std::vector<function_index>(pool.size());
+        type_shards = std::vector<type_index>(pool.size());
+        pool.run(cus.size(), [&](std::size_t task, std::size_t worker) {
+            if (skip[task]) {
+                return;
+            }
+            const auto &cu = cus[task];
+            try {
+                pc_shards[worker].add_unit(cu);
+                line_shards[worker].add_unit(cu);
+                function_shards[worker].add_unit(cu);
+                type_shards[worker].add_unit(cu);
+            } catch (std::exception &e) {
+                std::lock_guard<std::mutex> lock{skipped_mutex};
+                skip[task] = true;
+                skipped.emplace_back(cu.get_section_offset(), e.what());
             }
+        });
+        if (skipped.size() == n_skipped) {
+            break;
         }
     }
-    throw std::out_of_range{"cannot find function"};
+    std::sort(skipped.begin(), skipped.end());
+    for (const auto &[offset, error]: skipped) {
+        std::cerr << "Skipping the unit at .debug_info offset 0x" << std::hex << offset << ": " << error
+                  << std::endl;
+    }
+
+    for (std::size_t i = 0; i < pool.size(); ++i) {
+        m_pc_index.merge(std::move(pc_shards[i]));
+        m_line_index.merge(std::move(line_shards[i]));
+        m_function_index.merge(std::move(function_shards[i]));
+        m_type_index.merge(std::move(type_shards[i]));
+    }
+    m_pc_index.finalize();
+    m_line_index.finalize();
+    m_function_index.finalize(image);
+    m_type_index.finalize();
+
+    // a cache would hide the skipped units on the next start
+    if (!cache_path.empty() && skipped.empty()) {
+        index_cache::writer out{};
+        m_pc_index.save(out);
+        m_line_index.save(out);
+        m_function_index.save(out);
+        m_type_index.save(out);
+        // a cache which can't be written only costs the next start
+        out.write(cache_path, build_id, image.size());
+    }
 }
 
-// simply find the correct compilation unit, then ask the line table to get us
-// the relevant entry
+bool debugger::load_cached_indexes(const std::string &path, std::string_view build_id, std::string_view image) {
+    m_index_cache = index_cache::reader::open(path, build_id, image.size());
+    if (!m_index_cache) {
+        return false;
+    }
+    try {
+        m_pc_index.load(*m_index_cache);
+        m_line_index.load(*m_index_cache);
+        m_function_index.load(*m_index_cache, image);
+        m_type_index.load(*m_index_cache);
+        return true;
+    } catch (index_cache::format_error &) {
+        m_pc_index = pc_index{};
+        m_line_index = line_index{};
+        m_function_index = function_index{};
+        m_type_index = type_index{};
+        m_index_cache.reset();
+        return false;
+    }
+}
+
+// the compilation unit comes from the .debug_aranges map, then ask the line
+// table to get us the relevant entry
 dwarf::line_table::iterator debugger::get_line_entry_from_pc(uint64_t pc) {
-    for (auto &cu: m_dwarf.compilation_units()) {
-        if (die_pc_range(cu.root()).contains(pc)) {
-            auto &lt = cu.get_line_table();
-            auto it = lt.find_address(pc);
-            if (it == lt.end()) {
-                throw std::out_of_range{"cannot find line entry"};
-            } else {
-                return it;
-            }
-        }
+    const dwarf::compilation_unit *cu;
+    try {
+        cu = &m_dwarf.get_compilation_unit(pc);
+    } catch (std::out_of_range &) {
+        throw std::out_of_range{"cannot find line entry"};
+    }
+
+    auto &lt = cu->get_line_table();
+    auto it = lt.find_address(pc);
+    if (it == lt.end()) {
+        throw std::out_of_range{"cannot find line entry"};
     }
-    throw std::out_of_range{"cannot find line entry"};
+    return it;
 }
 
 void debugger::print_source(const std::string &file_name, unsigned line, unsigned n_lines_context) {
@@ -285,11 +622,42 @@ void debugger::handle_sigtrap(siginfo_t info) {
         case SI_KERNEL:
         case TRAP_BRKPT: {
             set_pc(get_pc() - 1); //put the pc back where is should be
+            if (!should_stop_at(get_pc())) {
+                m_resume_after_stop = true;
+                return;
+            }
             std::cout << "Hit breakpoint at address 0x" << std::hex << get_pc() << std::endl;
             auto line_entry = get_line_entry_from_pc(get_pc());
             print_source(line_entry->file->path, line_entry->line);
             return;;
         }
+        case TRAP_HWBKPT: {
+            auto slot = m_watchpoints.triggered();
+            if (!slot) {
+                std::cout << "Unknown hardware breakpoint" << std::endl;
+                return;
+            }
+            auto &wp = m_watchpoints.at(*slot);
+            uint64_t value = 0;
+            read_memory(wp.addr, &value, wp.len);
+            std::cout << "Hit hardware " << to_string(wp.kind) << ' ' << *slot
+                      << " at address 0x" << std::hex << wp.addr << std::endl;
+            if (value != wp.value) {
+                std::cout << "Old value = 0x" << wp.value << std::endl;
+                std::cout << "New value = 0x" << value << std::endl;
+                wp.value = value;
+            } else {
+                std::cout << "Value = 0x" << value << std::endl;
+            }
+            // watched data is often written from code without line info
+            try {
+                auto line_entry = get_line_entry_from_pc(get_pc());
+                print_source(line_entry->file->path, line_entry->line);
+            } catch (std::out_of_range &e) {
+                std::cout << "at 0x" << get_pc() << std::endl;
+            }
+            return;
+        }
         case TRAP_TRACE:
             return;
         default:
@@ -299,13 +667,13 @@ void debugger::handle_sigtrap(siginfo_t info) {
 }
 
 void debugger::single_step_instruction() {
-    ptrace(PTRACE_SINGLESTEP, m_pid, nullptr, nullptr);
+    resume(PTRACE_SINGLESTEP);
     wait_for_signal();
 }
 
 void debugger::single_step_instruction_with_breakpoint_check() {
     // check to see if we need to disable and enable a breakpoint
-    if (m_breakpoints.count(get_pc())) {
+    if (m_breakpoints.contains(get_pc())) {
         step_over_breakpoint();
     } else {
         single_step_instruction();
@@ -314,11 +682,11 @@ void debugger::single_step_instruction_with_breakpoint_check() {
 }
 
 void debugger::step_out() {
-    auto frame_pointer = get_register_value(m_pid, reg::rbp);
+    auto frame_pointer = get_register_value(registers(), reg::rbp);
     auto return_address = read_memory(frame_pointer + 8);
 
     bool should_remove_breakpoint = false;
-    if (!m_breakpoints.count(return_address)) {
+    if (!m_breakpoints.contains(return_address)) {
         set_breakpoint_at_address(return_address);
         should_remove_breakpoint = true;
     }
@@ -331,10 +699,30 @@ void debugger::step_out() {
 }
 
 void debugger::remove_breakpoint(std::intptr_t addr) {
-    if (m_breakpoints.at(addr).is_enabled()) {
-        m_breakpoints.at(addr).disable();
-    }
     m_breakpoints.erase(addr);
+    m_conditions.erase(addr);
+}
+
+void debugger::set_watchpoint(std::intptr_t addr, std::size_t len, watch_kind kind) {
+    uint64_t value = 0;
+    if (len <= sizeof(value)) {
+        read_memory(addr, &value, len);
+    }
+    try {
+        auto slot = m_watchpoints.add(addr, len, kind, value);
+        std::cout << "Set hardware " << to_string(kind) << ' ' << slot
+                  << " at address 0x" << std::hex << addr << std::endl;
+    } catch (std::exception &e) {
+        std::cerr << "Cannot set watchpoint: " << e.what() << std::endl;
+    }
+}
+
+void debugger::remove_watchpoint(std::intptr_t addr) {
+    try {
+        m_watchpoints.remove(addr);
+    } catch (std::out_of_range &) {
+        std::cerr << "No watchpoint at 0x" << std::hex << addr << std::endl;
+    }
 }
 
 void debugger::step_in() {
@@ -356,54 +744,511 @@ void debugger::step_over() {
     auto line = get_line_entry_from_pc(func_entry);
     auto start_line = get_line_entry_from_pc(get_pc());
 
-    std::vector<std::intptr_t> to_delete{};
+    std::vector<std::intptr_t> addrs{};
 
     while (line->address < func_end) {
-        if (line->address != start_line->address && !m_breakpoints.count(line->address)) {
-            set_breakpoint_at_address(line->address);
-            to_delete.push_back(line->address);
+        if (line->address != start_line->address && !patched_by_tracepoint(line->address)) {
+            addrs.push_back(line->address);
         }
         ++line;
     }
 
-    auto frame_pointer = get_register_value(m_pid, reg::rbp);
-    auto return_address = read_memory(frame_pointer + 8);
+    // the temporary breakpoints are patched in and out word by word, the
+    // user's breakpoints at the same addresses are left alone
+    std::vector<std::intptr_t> to_delete{};
+    try {
+        to_delete = m_breakpoints.insert_batch(std::move(addrs));
+    } catch (std::runtime_error &e) {
+        std::cerr << "Cannot step over: " << e.what() << std::endl;
+        return;
+    }
 
-    if (!m_breakpoints.count(return_address)) {
-        set_breakpoint_at_address(return_address);
-        to_delete.push_back(return_address);
+    // the return address comes from the frame pointer, which is garbage
+    // in a function which doesn't keep one
+    auto frame_pointer = get_register_value(registers(), reg::rbp);
+    auto return_address = static_cast<std::intptr_t>(read_memory(frame_pointer + 8));
+    try {
+        if (auto tracepoint = patched_by_tracepoint(return_address)) {
+            throw std::runtime_error{"patched by the tracepoint at 0x" + to_hex(*tracepoint)};
+        }
+        auto added = m_breakpoints.insert_batch({return_address});
+        to_delete.insert(to_delete.end(), added.begin(), added.end());
+    } catch (std::runtime_error &) {
+        std::cerr << "Cannot stop at the return address 0x" << std::hex << return_address << std::endl;
     }
 
-    continue_execution();
+    try {
+        continue_execution();
+    } catch (...) {
+        m_breakpoints.erase_batch(to_delete);
+        throw;
+    }
+    m_breakpoints.erase_batch(to_delete);
+}
 
-    for (auto addr: to_delete) {
-        remove_breakpoint(addr);
+std::vector<std::intptr_t> debugger::set_breakpoint_at_function(const std::string &name) {
+    auto addrs = find_function_addresses(name);
+    for (auto addr: addrs) {
+        set_breakpoint_at_address(addr);
     }
+    return addrs;
 }
 
-void debugger::set_breakpoint_at_function(const std::string &name) {
-    for (const auto &cu : m_dwarf.compilation_units()) {
-        for (const auto &die: cu.root()) {
-            if (die.has(dwarf::DW_AT::name) && at_name(die) == name) {
-                auto low_pc = at_low_pc(die);
-                auto entry = get_line_entry_from_pc(low_pc);
-                ++entry; //skip prologue
-                set_breakpoint_at_address(entry->address);
+std::vector<std::intptr_t> debugger::set_breakpoint_at_source_line(const std::string &file, unsigned line) {
+    auto addrs = find_source_line_addresses(file, line);
+    for (auto addr: addrs) {
+        set_breakpoint_at_address(addr);
+    }
+    return addrs;
+}
+
+// addresses after the prologue of every function with this name
+std::vector<std::intptr_t> debugger::find_function_addresses(const std::string &name) {
+    auto entries = m_function_index.find(name);
+    return {entries.begin(), entries.end()};
+}
+
+// the lowest statement at this line in every function and every inlined or
+// template instance of it, so a loop header stops once per iteration instead
+// of at its init, test and increment
+std::vector<std::intptr_t> debugger::find_source_line_addresses(const std::string &file, unsigned line) {
+    std::vector<std::intptr_t> addrs{};
+    std::unordered_set<dwarf::section_offset> instances{};
+    for (auto addr: m_line_index.find(file, line)) {
+        auto instance = m_pc_index.instance_at(addr);
+        if (instance && !instances.insert(*instance).second) {
+            continue;
+        }
+        addrs.push_back(static_cast<std::intptr_t>(addr));
+    }
+    return addrs;
+}
+
+// 0xADDRESS, file:line or a function name, as accepted by break
+std::vector<std::intptr_t> debugger::find_location_addresses(const std::string &location) {
+    if (location.size() > 2 && location[0] == '0' && location[1] == 'x') {
+        return {std::stol(location.substr(2), 0, 16)};
+    }
+    if (is_source_location(location)) {
+        auto file_and_line = split(location, ':');
+        return find_source_line_addresses(file_and_line[0], std::stoi(file_and_line[1]));
+    }
+    return find_function_addresses(location);
+}
+
+// trace <location> [variable...]
+void debugger::set_tracepoint(const std::string &location, const std::vector<std::string> &vars) {
+    if (!m_agent) {
+        m_agent = trace_agent::attach(m_pid);
+        if (!m_agent) {
+            std::cerr << "The tracing agent is not loaded, start the program with --agent" << std::endl;
+            return;
+        }
+    }
+
+    for (auto addr: find_location_addresses(location)) {
+        try {
+            std::vector<trace_capture> captures{};
+            for (const auto &name: vars) {
+                auto var = resolve_variable(addr, name);
+                if (!var) {
+                    throw std::runtime_error{"no variable " + name + " in scope"};
+                }
+                captures.push_back({name, *var});
+            }
+            // the int3 would be copied into the jump pad
+            for (std::size_t i = 0; i < 2 * x86_max_instruction_length; ++i) {
+                if (m_breakpoints.contains(addr + i)) {
+                    throw std::runtime_error{"remove the breakpoint at 0x" + to_hex(addr + i) + " first"};
+                }
             }
+            m_agent->add(m_memory, addr, get_pc(), std::move(captures));
+            std::cout << "Set tracepoint at address 0x" << std::hex << addr << std::endl;
+        } catch (std::exception &e) {
+            std::cerr << "Cannot set tracepoint at 0x" << std::hex << addr << ": " << e.what() << std::endl;
         }
     }
 }
 
-void debugger::set_breakpoint_at_source_line(const std::string &file, unsigned line) {
-    for (const auto &cu: m_dwarf.compilation_units()) {
-        const auto &lt = cu.get_line_table();
+std::optional<std::intptr_t> debugger::patched_by_tracepoint(std::intptr_t addr) {
+    return m_agent ? m_agent->patched_at(addr) : std::nullopt;
+}
 
-        for (const auto &entry: lt) {
-            if (entry.is_stmt && entry.line == line) {
-                set_breakpoint_at_address(entry.address);
-                return;
+void debugger::remove_tracepoint(std::intptr_t addr) {
+    try {
+        if (!m_agent) {
+            throw std::runtime_error{"no tracepoints"};
+        }
+        m_agent->remove(m_memory, addr, get_pc());
+    } catch (std::exception &e) {
+        std::cerr << "Cannot remove tracepoint: " << e.what() << std::endl;
+    }
+}
+
+void debugger::set_breakpoint_condition(std::intptr_t addr, const std::string &expr) {
+    try {
+        condition cond{expr, [&](const std::string &name) { return resolve_variable(addr, name); }};
+        m_conditions.insert_or_assign(addr, breakpoint_condition{std::move(cond)});
+    } catch (std::exception &e) {
+        std::cerr << "Cannot set condition at 0x" << std::hex << addr << ": " << e.what() << std::endl;
+    }
+}
+
+// compiled once when the breakpoint is set, so a hit only reads the cached
+// registers and the memory pages the expression touches
+bool debugger::should_stop_at(std::intptr_t addr) {
+    auto it = m_conditions.find(addr);
+    if (it == m_conditions.end()) {
+        return true;
+    }
+
+    auto &bc = it->second;
+    auto start = std::chrono::steady_clock::now();
+    bool stop = bc.cond.evaluate(registers(), m_memory) != 0;
+    bc.eval_time += std::chrono::steady_clock::now() - start;
+    ++bc.hits;
+    if (stop) {
+        ++bc.stops;
+    }
+    return stop;
+}
+
+void debugger::dump_breakpoint_conditions() {
+    for (const auto &[addr, bc]: m_conditions) {
+        auto ns = bc.eval_time.count();
+        std::cout << "0x" << std::hex << addr << std::dec
+                  << " if " << bc.cond.text()
+                  << ": hits " << bc.hits
+                  << ", stops " << bc.stops
+                  << ", eval " << (bc.hits ? ns / static_cast<int64_t>(bc.hits) : 0) << " ns/hit"
+                  << std::endl;
+    }
+}
+
+namespace {
+    // follow typedefs and cv-qualifiers down to a base or pointer type and
+    // return its size and signedness, nothing for aggregates
+    std::optional<std::pair<std::size_t, bool>> scalar_type(dwarf::die type) {
+        while (type.tag == dwarf::DW_TAG::typedef_ || type.tag == dwarf::DW_TAG::const_type ||
+               type.tag == dwarf::DW_TAG::volatile_type) {
+            if (!type.has(dwarf::DW_AT::type)) {
+                return std::nullopt;
+            }
+            type = type[dwarf::DW_AT::type].as_reference();
+        }
+
+        if (type.tag == dwarf::DW_TAG::pointer_type) {
+            return std::make_pair(sizeof(uint64_t), false);
+        }
+        if (type.tag == dwarf::DW_TAG::base_type || type.tag == dwarf::DW_TAG::enumeration_type) {
+            auto size = type[dwarf::DW_AT::byte_size].as_uconstant();
+            bool is_signed = type.tag == dwarf::DW_TAG::enumeration_type;
+            if (type.has(dwarf::DW_AT::encoding)) {
+                auto enc = static_cast<dwarf::DW_ATE>(type[dwarf::DW_AT::encoding].as_uconstant());
+                is_signed = enc == dwarf::DW_ATE::signed_ || enc == dwarf::DW_ATE::signed_char;
+            }
+            if (size == 1 || size == 2 || size == 4 || size == 8) {
+                return std::make_pair(static_cast<std::size_t>(size), is_signed);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // only the two location forms gcc and clang use for variables at -O0:
+    // DW_OP_addr for globals and DW_OP_fbreg for locals
+    std::optional<condition_variable> variable_location(const dwarf::die &var, const dwarf::die *func) {
+        if (!var.has(dwarf::DW_AT::location) || !var.has(dwarf::DW_AT::type)) {
+            return std::nullopt;
+        }
+        auto type = scalar_type(var[dwarf::DW_AT::type].as_reference());
+        if (!type) {
+            return std::nullopt;
+        }
+
+        std::size_t len = 0;
+        auto *loc = static_cast<const uint8_t *>(var[dwarf::DW_AT::location].as_block(&len));
+        if (len == 9 && loc[0] == static_cast<uint8_t>(dwarf::DW_OP::addr)) {
+            uint64_t addr{};
+            std::memcpy(&addr, loc + 1, sizeof(addr));
+            return condition_variable{std::nullopt, static_cast<int64_t>(addr), type->first, type->second};
+        }
+        if (len < 2 || loc[0] != static_cast<uint8_t>(dwarf::DW_OP::fbreg) || !func ||
+            !func->has(dwarf::DW_AT::frame_base)) {
+            return std::nullopt;
+        }
+
+        // frame base relative to rbp, which this debugger already assumes to
+        // be the frame pointer
+        std::size_t fb_len = 0;
+        auto *fb = static_cast<const uint8_t *>((*func)[dwarf::DW_AT::frame_base].as_block(&fb_len));
+        int64_t frame_base;
+        if (fb_len == 1 && fb[0] == static_cast<uint8_t>(dwarf::DW_OP::call_frame_cfa)) {
+            frame_base = 16; // return address and saved rbp
+        } else if (fb_len == 1 && fb[0] == static_cast<uint8_t>(dwarf::DW_OP::reg0) + 6) {
+            frame_base = 0;
+        } else {
+            return std::nullopt;
+        }
+
+        // sleb128 offset from the frame base
+        int64_t offset = 0;
+        unsigned shift = 0;
+        std::size_t i = 1;
+        uint8_t byte;
+        do {
+            byte = loc[i++];
+            offset |= static_cast<int64_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while ((byte & 0x80) && i < len);
+        if (shift < 64 && (byte & 0x40)) {
+            offset |= -(int64_t{1} << shift);
+        }
+        return condition_variable{reg::rbp, frame_base + offset, type->first, type->second};
+    }
+
+    // the innermost declaration of name visible at pc, a block which shadows a
+    // variable wins over the scope enclosing it
+    std::optional<dwarf::die> find_variable(const dwarf::die &scope, uint64_t pc, const std::string &name) {
+        for (const auto &die: scope) {
+            if (die.tag != dwarf::DW_TAG::lexical_block ||
+                (!die.has(dwarf::DW_AT::low_pc) && !die.has(dwarf::DW_AT::ranges)) ||
+                !die_pc_range(die).contains(pc)) {
+                continue;
+            }
+            if (auto var = find_variable(die, pc, name)) {
+                return var;
+            }
+        }
+        for (const auto &die: scope) {
+            if ((die.tag == dwarf::DW_TAG::variable || die.tag == dwarf::DW_TAG::formal_parameter) &&
+                die.has(dwarf::DW_AT::name) && at_name(die) == name) {
+                return die;
             }
         }
+        return std::nullopt;
+    }
+}
+
+std::optional<condition_variable> debugger::resolve_variable(uint64_t pc, const std::string &name) {
+    auto var = lookup_variable(pc, name);
+    if (!var) {
+        return std::nullopt;
+    }
+    // only a local's location refers to the frame base of its function
+    std::optional<dwarf::die> func{};
+    try {
+        func = get_function_from_pc(pc);
+    } catch (std::out_of_range &) {
+    }
+    return variable_location(*var, func ? &*func : nullptr);
+}
+
+// a local or parameter of the function containing pc, then a global
+std::optional<dwarf::die> debugger::lookup_variable(uint64_t pc, const std::string &name) {
+    try {
+        if (auto var = find_variable(get_function_from_pc(pc), pc, name)) {
+            return var;
+        }
+    } catch (std::out_of_range &) {
+    }
+
+    if (auto offset = m_type_index.find_global(name)) {
+        return m_dwarf.get_die(*offset);
+    }
+    return std::nullopt;
+}
+
+namespace {
+    bool is_modifier(dwarf::DW_TAG tag) {
+        return tag == dwarf::DW_TAG::typedef_ || tag == dwarf::DW_TAG::const_type ||
+               tag == dwarf::DW_TAG::volatile_type || tag == dwarf::DW_TAG::pointer_type ||
+               tag == dwarf::DW_TAG::reference_type || tag == dwarf::DW_TAG::rvalue_reference_type ||
+               tag == dwarf::DW_TAG::array_type;
+    }
+
+    // an unsigned constant count or upper bound of an array dimension
+    std::optional<uint64_t> constant_bound(const dwarf::die &dim, dwarf::DW_AT attr) {
+        if (!dim.has(attr)) {
+            return std::nullopt;
+        }
+        auto bound = dim[attr];
+        if (bound.get_type() != dwarf::value::type::constant && bound.get_type() != dwarf::value::type::uconstant) {
+            return std::nullopt;
+        }
+        return bound.as_uconstant();
+    }
+
+    // C-like spelling of a type, "const char *", "point[4]"
+    std::string type_name(const dwarf::die &type) {
+        auto inner = [&type]() {
+            return type.has(dwarf::DW_AT::type) ? type_name(type[dwarf::DW_AT::type].as_reference())
+                                                : std::string{"void"};
+        };
+        switch (type.tag) {
+            case dwarf::DW_TAG::pointer_type:
+                return inner() + " *";
+            case dwarf::DW_TAG::reference_type:
+                return inner() + " &";
+            case dwarf::DW_TAG::rvalue_reference_type:
+                return inner() + " &&";
+            case dwarf::DW_TAG::const_type:
+                return "const " + inner();
+            case dwarf::DW_TAG::volatile_type:
+                return "volatile " + inner();
+            case dwarf::DW_TAG::array_type: {
+                auto name = inner();
+                for (const auto &dim: type) {
+                    if (dim.tag != dwarf::DW_TAG::subrange_type) {
+                        continue;
+                    }
+                    // the bounds of a variable length array are
+                    // expressions, it is printed as "int[]"
+                    name += '[';
+                    if (auto count = constant_bound(dim, dwarf::DW_AT::count)) {
+                        name += std::to_string(*count);
+                    } else if (auto upper = constant_bound(dim, dwarf::DW_AT::upper_bound)) {
+                        name += std::to_string(*upper + 1);
+                    }
+                    name += ']';
+                }
+                return name;
+            }
+            case dwarf::DW_TAG::subroutine_type:
+                return "function";
+            default:
+                return type.has(dwarf::DW_AT::name) ? at_name(type) : std::string{"<anonymous>"};
+        }
+    }
+
+    std::string_view kind_name(dwarf::DW_TAG tag) {
+        switch (tag) {
+            case dwarf::DW_TAG::class_type:
+                return "class";
+            case dwarf::DW_TAG::structure_type:
+                return "struct";
+            case dwarf::DW_TAG::union_type:
+                return "union";
+            case dwarf::DW_TAG::enumeration_type:
+                return "enum";
+            default:
+                return "type";
+        }
+    }
+
+    // whether the values of an integer or enumeration type are signed, from
+    // its encoding or, for an enumeration without one, its underlying type
+    std::optional<bool> is_signed_type(dwarf::die type) {
+        while (true) {
+            if (type.has(dwarf::DW_AT::encoding)) {
+                auto enc = static_cast<dwarf::DW_ATE>(type[dwarf::DW_AT::encoding].as_uconstant());
+                return enc == dwarf::DW_ATE::signed_ || enc == dwarf::DW_ATE::signed_char;
+            }
+            if (type.tag != dwarf::DW_TAG::enumeration_type && type.tag != dwarf::DW_TAG::typedef_ &&
+                type.tag != dwarf::DW_TAG::const_type && type.tag != dwarf::DW_TAG::volatile_type) {
+                return std::nullopt;
+            }
+            if (!type.has(dwarf::DW_AT::type)) {
+                return std::nullopt;
+            }
+            type = type[dwarf::DW_AT::type].as_reference();
+        }
+    }
+
+    // an enumerator in decimal. data1 to data8 don't say whether the value is
+    // signed, the enumeration's type does; without one they are taken as
+    // unsigned, compilers use sdata for negative values then.
+    std::string enumerator_value(const dwarf::value &v, std::optional<bool> is_signed) {
+        switch (v.get_type()) {
+            case dwarf::value::type::sconstant:
+                return std::to_string(v.as_sconstant());
+            case dwarf::value::type::uconstant:
+                return std::to_string(v.as_uconstant());
+            case dwarf::value::type::constant:
+                return is_signed.value_or(false) ? std::to_string(v.as_sconstant())
+                                                 : std::to_string(v.as_uconstant());
+            default:
+                return "?";
+        }
+    }
+
+    bool is_constant(const dwarf::value &v) {
+        return v.get_type() == dwarf::value::type::constant || v.get_type() == dwarf::value::type::uconstant ||
+               v.get_type() == dwarf::value::type::sconstant;
+    }
+}
+
+// Goes through typedefs, qualifiers, pointers and arrays to the structure,
+// class, union or enumeration and lists its members. A unit which only
+// declares the type has no members for it, the type index has the unit
+// which defines it.
+void debugger::print_type(const std::string &name) {
+    std::optional<dwarf::die> type{};
+    if (auto offset = m_type_index.find(name)) {
+        type = m_dwarf.get_die(*offset);
+    } else if (auto var = lookup_variable(get_pc(), name); var && var->has(dwarf::DW_AT::type)) {
+        type = (*var)[dwarf::DW_AT::type].as_reference();
+    }
+    if (!type) {
+        std::cerr << "No type or variable " << name << std::endl;
+        return;
+    }
+
+    auto layout = *type;
+    while (is_modifier(layout.tag) && layout.has(dwarf::DW_AT::type)) {
+        layout = layout[dwarf::DW_AT::type].as_reference();
+    }
+    if (layout != *type) {
+        std::cout << type_name(*type) << std::endl;
+    }
+    if (layout.has(dwarf::DW_AT::declaration)) {
+        auto definition = m_type_index.definition_of(layout.get_section_offset());
+        if (!definition) {
+            std::cout << kind_name(layout.tag) << ' ' << type_name(layout) << ", incomplete" << std::endl;
+            return;
+        }
+        layout = m_dwarf.get_die(*definition);
+    }
+
+    std::cout << kind_name(layout.tag) << ' ' << type_name(layout);
+    if (layout.has(dwarf::DW_AT::byte_size)) {
+        std::cout << ", size " << std::dec << layout[dwarf::DW_AT::byte_size].as_uconstant();
+    }
+    std::cout << std::endl;
+    auto enum_signed = layout.tag == dwarf::DW_TAG::enumeration_type ? is_signed_type(layout) : std::nullopt;
+    for (const auto &member: layout) {
+        auto member_name = member.has(dwarf::DW_AT::name) ? at_name(member) : std::string{};
+        if (member.tag == dwarf::DW_TAG::enumerator) {
+            std::cout << "    " << member_name << " = "
+                      << enumerator_value(member[dwarf::DW_AT::const_value], enum_signed) << std::endl;
+            continue;
+        }
+        if (member.tag != dwarf::DW_TAG::member && member.tag != dwarf::DW_TAG::inheritance) {
+            continue;
+        }
+
+        // static members have no location in the object
+        std::string offset{"static"};
+        if (member.has(dwarf::DW_AT::data_member_location)) {
+            auto location = member[dwarf::DW_AT::data_member_location];
+            offset = is_constant(location) ? std::to_string(location.as_uconstant()) : "?";
+        } else if (layout.tag == dwarf::DW_TAG::union_type) {
+            offset = "0";
+        }
+        std::cout << std::setw(10) << offset << "  ";
+        if (member.tag == dwarf::DW_TAG::inheritance) {
+            std::cout << "base ";
+        }
+        auto member_type = type_name(member[dwarf::DW_AT::type].as_reference());
+        std::cout << member_type;
+        if (!member_name.empty()) {
+            // "char *name" rather than "char * name"
+            auto last = member_type.back();
+            std::cout << (last == '*' || last == '&' ? "" : " ") << member_name;
+        }
+        if (member.has(dwarf::DW_AT::bit_size)) {
+            std::cout << " : " << std::dec << member[dwarf::DW_AT::bit_size].as_uconstant();
+        }
+        std::cout << std::endl;
     }
 }
 
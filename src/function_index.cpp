@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <optional>
+#include "../include/function_index.h"
+
+namespace {
+    bool is_scope(dwarf::DW_TAG tag) {
+        return tag == dwarf::DW_TAG::namespace_ || tag == dwarf::DW_TAG::class_type ||
+               tag == dwarf::DW_TAG::structure_type || tag == dwarf::DW_TAG::union_type;
+    }
+
+    const char *name_of(const dwarf::die &die) {
+        return die.has(dwarf::DW_AT::name) ? die[dwarf::DW_AT::name].as_cstr() : nullptr;
+    }
+
+    // the first row flagged prologue_end, gcc does not set it so fall back to
+    // the second row of the function
+    uint64_t skip_prologue(const dwarf::line_table &lt, uint64_t low, uint64_t high) {
+        if (!lt.valid()) {
+            return low;
+        }
+        std::optional<uint64_t> second{};
+        for (auto it = lt.find_address(low); it != lt.end() && !it->end_sequence && it->address < high; ++it) {
+            if (it->prologue_end) {
+                return it->address;
+            }
+            if (!second && it->address > low) {
+                second = it->address;
+            }
+        }
+        return second.value_or(low);
+    }
+
+    // "a::b<c::d>::f" -> a, b<c::d>, f
+    std::vector<std::string_view> split_qualified(std::string_view name) {
+        std::vector<std::string_view> parts{};
+        std::size_t start = 0;
+        int depth = 0;
+        for (std::size_t i = 0; i < name.size(); ++i) {
+            if (name[i] == '<') {
+                ++depth;
+            } else if (name[i] == '>' && depth > 0) {
+                --depth;
+            } else if (depth == 0 && name.compare(i, 2, "::") == 0) {
+                parts.push_back(name.substr(start, i - start));
+                start = i + 2;
+                ++i;
+            }
+        }
+        parts.push_back(name.substr(start));
+        return parts;
+    }
+}
+
+void function_index::add_unit(const dwarf::compilation_unit &cu) {
+    add_dies(cu.root(), no_scope, cu.get_line_table());
+}
+
+void function_index::add_dies(const dwarf::die &parent, uint32_t scope, const dwarf::line_table &lt) {
+    for (const auto &die: parent) {
+        if (is_scope(die.tag)) {
+            auto inner = scope;
+            // anonymous namespaces and classes don't qualify the names in them
+            if (auto name = name_of(die)) {
+                inner = static_cast<uint32_t>(m_scopes.size());
+                m_scopes.push_back({name, scope});
+            }
+            add_dies(die, inner, lt);
+            continue;
+        }
+        if (die.tag != dwarf::DW_TAG::subprogram) {
+            continue;
+        }
+
+        auto name = name_of(die);
+        dwarf::section_offset next = 0;
+        if (!name) {
+            if (die.has(dwarf::DW_AT::specification)) {
+                next = die[dwarf::DW_AT::specification].as_reference().get_section_offset();
+            } else if (die.has(dwarf::DW_AT::abstract_origin)) {
+                next = die[dwarf::DW_AT::abstract_origin].as_reference().get_section_offset();
+            } else {
+                continue;
+            }
+        }
+        m_origins.emplace(die.get_section_offset(), origin{name, scope, next});
+
+        // declarations and abstract instances have no code
+        if (!die.has(dwarf::DW_AT::low_pc) && !die.has(dwarf::DW_AT::ranges)) {
+            continue;
+        }
+        auto ranges = die_pc_range(die);
+        if (ranges.begin() == ranges.end()) {
+            continue;
+        }
+        uint64_t low = die.has(dwarf::DW_AT::low_pc) ? at_low_pc(die) : ranges.begin()->low;
+        // the linker leaves functions it discarded at address 0
+        if (low == 0) {
+            continue;
+        }
+        uint64_t high = low + 1;
+        for (const auto &range: ranges) {
+            if (range.contains(low)) {
+                high = range.high;
+                break;
+            }
+        }
+
+        auto entry = skip_prologue(lt, low, high);
+        if (name) {
+            add_function(name, scope, entry);
+        } else {
+            m_deferred.push_back({next, entry});
+        }
+    }
+}
+
+void function_index::add_function(const char *name, uint32_t scope, uint64_t entry) {
+    std::string_view view{name};
+    m_functions.push_back({view, scope, entry});
+    // a template function is also found without its arguments, operator< and
+    // friends are not templates
+    auto bracket = view.find('<');
+    if (bracket != std::string_view::npos && bracket > 0 && view.back() == '>' &&
+        view.compare(0, 8, "operator") != 0) {
+        m_functions.push_back({view.substr(0, bracket), scope, entry});
+    }
+}
+
+void function_index::merge(function_index &&shard) {
+    // the shard numbered its scopes on its own
+    auto base = static_cast<uint32_t>(m_scopes.size());
+    auto rebase = [base](uint32_t scope) {
+        return scope == no_scope ? no_scope : scope + base;
+    };
+    for (const auto &s: shard.m_scopes) {
+        m_scopes.push_back({s.name, rebase(s.parent)});
+    }
+    for (const auto &f: shard.m_functions) {
+        m_functions.push_back({f.name, rebase(f.scope), f.entry});
+    }
+    for (const auto &[offset, o]: shard.m_origins) {
+        m_origins.emplace(offset, origin{o.name, rebase(o.scope), o.next});
+    }
+    m_deferred.insert(m_deferred.end(), shard.m_deferred.begin(), shard.m_deferred.end());
+    shard = function_index{};
+}
+
+void function_index::finalize(std::string_view image) {
+    for (const auto &d: m_deferred) {
+        // a concrete out of line instance refers to its abstract instance,
+        // which may in turn refer to the declaration inside a class
+        auto offset = d.origin;
+        for (int hops = 0; hops < 4; ++hops) {
+            auto it = m_origins.find(offset);
+            if (it == m_origins.end()) {
+                break;
+            }
+            if (it->second.name) {
+                add_function(it->second.name, it->second.scope, d.entry);
+                break;
+            }
+            offset = it->second.next;
+        }
+    }
+
+    m_image = image;
+    auto offset_of = [image](std::string_view name) {
+        return static_cast<uint64_t>(name.data() - image.data());
+    };
+
+    std::vector<uint64_t> scope_names{};
+    std::vector<uint32_t> scope_name_sizes{};
+    std::vector<uint32_t> scope_parents{};
+    for (const auto &s: m_scopes) {
+        std::string_view name{s.name};
+        scope_names.push_back(offset_of(name));
+        scope_name_sizes.push_back(static_cast<uint32_t>(name.size()));
+        scope_parents.push_back(s.parent);
+    }
+
+    std::sort(m_functions.begin(), m_functions.end(), [](const function &a, const function &b) {
+        return a.name < b.name;
+    });
+    std::vector<uint64_t> names{};
+    std::vector<uint32_t> name_sizes{};
+    std::vector<uint32_t> function_scopes{};
+    std::vector<uint64_t> entries{};
+    std::vector<uint32_t> group_begin{};
+    for (uint32_t i = 0; i < m_functions.size(); ++i) {
+        const auto &f = m_functions[i];
+        if (i == 0 || f.name != m_functions[i - 1].name) {
+            group_begin.push_back(i);
+        }
+        names.push_back(offset_of(f.name));
+        name_sizes.push_back(static_cast<uint32_t>(f.name.size()));
+        function_scopes.push_back(f.scope);
+        entries.push_back(f.entry);
+    }
+    auto n_groups = static_cast<uint32_t>(group_begin.size());
+    group_begin.push_back(static_cast<uint32_t>(m_functions.size()));
+
+    m_scope_names = flat_array{std::move(scope_names)};
+    m_scope_name_sizes = flat_array{std::move(scope_name_sizes)};
+    m_scope_parents = flat_array{std::move(scope_parents)};
+    m_names = flat_array{std::move(names)};
+    m_name_sizes = flat_array{std::move(name_sizes)};
+    m_function_scopes = flat_array{std::move(function_scopes)};
+    m_entries = flat_array{std::move(entries)};
+    m_group_begin = flat_array{std::move(group_begin)};
+    m_slots = flat_array{string_slots::build(n_groups, [this](uint32_t g) {
+        return group_name(g);
+    })};
+
+    m_deferred.clear();
+    m_deferred.shrink_to_fit();
+    m_origins.clear();
+    m_scopes.clear();
+    m_scopes.shrink_to_fit();
+    m_functions.clear();
+    m_functions.shrink_to_fit();
+}
+
+void function_index::save(index_cache::writer &out) const {
+    out.add(m_scope_names.span());
+    out.add(m_scope_name_sizes.span());
+    out.add(m_scope_parents.span());
+    out.add(m_names.span());
+    out.add(m_name_sizes.span());
+    out.add(m_function_scopes.span());
+    out.add(m_entries.span());
+    out.add(m_group_begin.span());
+    out.add(m_slots.span());
+}
+
+void function_index::load(index_cache::reader &in, std::string_view image) {
+    m_image = image;
+    m_scope_names = flat_array{in.next<uint64_t>()};
+    m_scope_name_sizes = flat_array{in.next<uint32_t>()};
+    m_scope_parents = flat_array{in.next<uint32_t>()};
+    m_names = flat_array{in.next<uint64_t>()};
+    m_name_sizes = flat_array{in.next<uint32_t>()};
+    m_function_scopes = flat_array{in.next<uint32_t>()};
+    m_entries = flat_array{in.next<uint64_t>()};
+    m_group_begin = flat_array{in.next<uint32_t>()};
+    m_slots = flat_array{in.next<uint32_t>()};
+
+    // the lookups index with these without checking
+    auto n_scopes = m_scope_names.size();
+    auto n = m_names.size();
+    auto in_image = [image](const flat_array<uint64_t> &offsets, const flat_array<uint32_t> &sizes) {
+        for (std::size_t i = 0; i < offsets.size(); ++i) {
+            if (offsets[i] > image.size() || sizes[i] > image.size() - offsets[i]) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto valid_scope = [n_scopes](uint32_t s) {
+        return s == no_scope || s < n_scopes;
+    };
+    auto slots = m_slots.span();
+    if (m_scope_name_sizes.size() != n_scopes || m_scope_parents.size() != n_scopes ||
+        m_name_sizes.size() != n || m_function_scopes.size() != n || m_entries.size() != n ||
+        !in_image(m_scope_names, m_scope_name_sizes) || !in_image(m_names, m_name_sizes) ||
+        !std::all_of(m_scope_parents.begin(), m_scope_parents.end(), valid_scope) ||
+        !std::all_of(m_function_scopes.begin(), m_function_scopes.end(), valid_scope) ||
+        m_group_begin.empty() || m_group_begin[0] != 0 || m_group_begin[m_group_begin.size() - 1] != n ||
+        !std::is_sorted(m_group_begin.begin(), m_group_begin.end()) ||
+        slots.empty() || (slots.size() & (slots.size() - 1)) != 0 ||
+        std::any_of(slots.begin(), slots.end(), [this](uint32_t g) {
+            return g != string_slots::empty && g + 1 >= m_group_begin.size();
+        })) {
+        throw index_cache::format_error{"function index tables are inconsistent"};
+    }
+}
+
+auto function_index::name_at(uint64_t offset, uint32_t size) const -> std::string_view {
+    return m_image.substr(offset, size);
+}
+
+auto function_index::group_name(uint32_t group) const -> std::string_view {
+    auto i = m_group_begin[group];
+    return name_at(m_names[i], m_name_sizes[i]);
+}
+
+auto function_index::scope_matches(uint32_t scope, const std::vector<std::string_view> &qualifiers) const -> bool {
+    // the qualifiers are the innermost scopes, compared from the inside out
+    for (auto q = qualifiers.rbegin(); q != qualifiers.rend(); ++q) {
+        if (scope == no_scope || *q != name_at(m_scope_names[scope], m_scope_name_sizes[scope])) {
+            return false;
+        }
+        scope = m_scope_parents[scope];
+    }
+    return true;
+}
+
+auto function_index::find(const std::string &name) const -> std::vector<uint64_t> {
+    auto qualifiers = split_qualified(name);
+    auto plain = qualifiers.back();
+    qualifiers.pop_back();
+
+    auto group = string_slots::find(m_slots.span(), plain, [this](uint32_t g) {
+        return group_name(g);
+    });
+    if (!group) {
+        return {};
+    }
+
+    std::vector<uint64_t> addrs{};
+    for (auto i = m_group_begin[*group]; i < m_group_begin[*group + 1]; ++i) {
+        if (scope_matches(m_function_scopes[i], qualifiers)) {
+            addrs.push_back(m_entries[i]);
+        }
+    }
+    std::sort(addrs.begin(), addrs.end());
+    addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+    return addrs;
+}
+
+auto function_index::empty() const -> bool {
+    return m_entries.empty();
+}
@@ -0,0 +1,242 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "../include/index_cache.h"
+
+namespace {
+    constexpr char magic[8] = {'M', 'D', 'B', 'G', 'I', 'D', 'X', '\n'};
+    constexpr std::size_t max_build_id = 64;
+    constexpr std::size_t alignment = 8;
+
+    struct header {
+        char magic[8];
+        uint32_t version;
+        uint32_t build_id_size;
+        uint8_t build_id[max_build_id];
+        uint64_t image_size;
+        uint64_t n_arrays;
+        uint64_t checksum; // of everything after the header
+    };
+
+    struct array_entry {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    std::size_t align_up(std::size_t n) {
+        return (n + alignment - 1) & ~(alignment - 1);
+    }
+
+    // Word at a time multiply-rotate hash. It only has to catch torn or
+    // damaged files, and runs over the whole cache on every start.
+    class checksum {
+    public:
+        void update(const void *data, std::size_t size) {
+            auto *p = static_cast<const unsigned char *>(data);
+            m_length += size;
+            while (size > 0 && m_pending_size > 0) {
+                push_byte(*p++);
+                --size;
+            }
+            for (; size >= sizeof(uint64_t); p += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+                uint64_t w;
+                std::memcpy(&w, p, sizeof(w));
+                mix(w);
+            }
+            while (size-- > 0) {
+                push_byte(*p++);
+            }
+        }
+
+        [[nodiscard]] auto value() const -> uint64_t {
+            auto h = m_hash;
+            if (m_pending_size > 0) {
+                h = step(h, m_pending);
+            }
+            return step(h, m_length);
+        }
+
+    private:
+        static uint64_t step(uint64_t h, uint64_t w) {
+            h ^= w * 0x9e3779b97f4a7c15ull;
+            h = (h << 29) | (h >> 35);
+            return h * 0xbf58476d1ce4e5b9ull;
+        }
+
+        void mix(uint64_t w) {
+            m_hash = step(m_hash, w);
+        }
+
+        void push_byte(unsigned char b) {
+            m_pending |= static_cast<uint64_t>(b) << (8 * m_pending_size);
+            if (++m_pending_size == sizeof(uint64_t)) {
+                mix(m_pending);
+                m_pending = 0;
+                m_pending_size = 0;
+            }
+        }
+
+        uint64_t m_hash{0x243f6a8885a308d3ull};
+        uint64_t m_pending{};
+        std::size_t m_pending_size{};
+        uint64_t m_length{};
+    };
+
+    std::string to_hex(std::string_view bytes) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex{};
+        for (unsigned char b: bytes) {
+            hex += digits[b >> 4];
+            hex += digits[b & 0xf];
+        }
+        return hex;
+    }
+}
+
+namespace index_cache {
+    auto path_for(std::string_view build_id) -> std::string {
+        std::filesystem::path dir{};
+        if (auto xdg = std::getenv("XDG_CACHE_HOME"); xdg && xdg[0] == '/') {
+            dir = xdg;
+        } else if (auto home = std::getenv("HOME"); home && home[0]) {
+            dir = std::filesystem::path{home} / ".cache";
+        } else {
+            return {};
+        }
+        return dir / "minidbg" / (to_hex(build_id) + ".idx");
+    }
+
+    auto writer::write(const std::string &path, std::string_view build_id, uint64_t image_size) const -> bool {
+        if (build_id.empty() || build_id.size() > max_build_id) {
+            return false;
+        }
+
+        header h{};
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.version = version;
+        h.build_id_size = static_cast<uint32_t>(build_id.size());
+        std::memcpy(h.build_id, build_id.data(), build_id.size());
+        h.image_size = image_size;
+        h.n_arrays = m_arrays.size();
+
+        std::vector<array_entry> table{};
+        auto offset = align_up(sizeof(header) + m_arrays.size() * sizeof(array_entry));
+        for (const auto &[data, size]: m_arrays) {
+            table.push_back({offset, size});
+            offset = align_up(offset + size);
+        }
+
+        std::error_code ec{};
+        std::filesystem::create_directories(std::filesystem::path{path}.parent_path(), ec);
+        auto tmp = path + ".tmp." + std::to_string(getpid());
+        std::ofstream out{tmp, std::ios::binary | std::ios::trunc};
+        if (!out) {
+            return false;
+        }
+
+        // the header goes last, once the checksum is known
+        static const char zeros[alignment] = {};
+        checksum sum{};
+        auto emit = [&](const void *data, std::size_t size) {
+            out.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+            sum.update(data, size);
+        };
+        out.seekp(sizeof(header));
+        emit(table.data(), table.size() * sizeof(array_entry));
+        auto pos = sizeof(header) + table.size() * sizeof(array_entry);
+        for (std::size_t i = 0; i < m_arrays.size(); ++i) {
+            emit(zeros, table[i].offset - pos);
+            emit(m_arrays[i].first, m_arrays[i].second);
+            pos = table[i].offset + table[i].size;
+        }
+        h.checksum = sum.value();
+        out.seekp(0);
+        out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        out.close();
+
+        if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    auto reader::open(const std::string &path, std::string_view build_id, uint64_t image_size)
+        -> std::unique_ptr<reader> {
+        if (path.empty()) {
+            return nullptr;
+        }
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(header)) {
+            close(fd);
+            return nullptr;
+        }
+        auto size = static_cast<std::size_t>(st.st_size);
+        auto *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+        auto r = std::make_unique<reader>(p, size);
+
+        header h{};
+        std::memcpy(&h, p, sizeof(h));
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.version != version ||
+            h.build_id_size != build_id.size() || build_id.size() > max_build_id ||
+            std::memcmp(h.build_id, build_id.data(), build_id.size()) != 0 || h.image_size != image_size) {
+            return nullptr;
+        }
+
+        // every array has to lie within the file
+        auto table_end = sizeof(header) + h.n_arrays * sizeof(array_entry);
+        if (h.n_arrays > size / sizeof(array_entry) || table_end > size) {
+            return nullptr;
+        }
+        for (uint64_t i = 0; i < h.n_arrays; ++i) {
+            array_entry e{};
+            std::memcpy(&e, r->m_data + sizeof(header) + i * sizeof(array_entry), sizeof(e));
+            if (e.offset % alignment != 0 || e.offset < table_end || e.offset > size || e.size > size - e.offset) {
+                return nullptr;
+            }
+        }
+
+        checksum sum{};
+        sum.update(r->m_data + sizeof(header), size - sizeof(header));
+        if (sum.value() != h.checksum) {
+            return nullptr;
+        }
+        return r;
+    }
+
+    reader::reader(const void *data, std::size_t size) : m_data{static_cast<const char *>(data)}, m_size{size} {
+    }
+
+    reader::~reader() {
+        munmap(const_cast<char *>(m_data), m_size);
+    }
+
+    auto reader::next_array(std::size_t element_size, std::size_t alignment)
+        -> std::pair<const void *, std::size_t> {
+        header h{};
+        std::memcpy(&h, m_data, sizeof(h));
+        if (m_next >= h.n_arrays) {
+            throw format_error{"index cache has too few arrays"};
+        }
+        array_entry e{};
+        std::memcpy(&e, m_data + sizeof(header) + m_next * sizeof(array_entry), sizeof(e));
+        ++m_next;
+        if (e.size % element_size != 0 || e.offset % alignment != 0) {
+            throw format_error{"index cache array has the wrong element type"};
+        }
+        return {m_data + e.offset, e.size};
+    }
+}
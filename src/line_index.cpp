@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <filesystem>
+#include "../include/line_index.h"
+
+namespace {
+    // collapses ".", ".." and repeated separators, without touching the
+    // file system since the sources need not exist here
+    std::string normalize(const std::string &path) {
+        return std::filesystem::path{path}.lexically_normal().string();
+    }
+
+    std::string_view basename(std::string_view path) {
+        auto slash = path.rfind('/');
+        return slash == std::string_view::npos ? path : path.substr(slash + 1);
+    }
+
+    bool matches(std::string_view path, std::string_view query) {
+        if (path.size() < query.size() || path.compare(path.size() - query.size(), query.size(), query) != 0) {
+            return false;
+        }
+        return path.size() == query.size() || query[0] == '/' || path[path.size() - query.size() - 1] == '/';
+    }
+}
+
+void line_index::add_unit(const dwarf::compilation_unit &cu) {
+    const auto &lt = cu.get_line_table();
+    if (!lt.valid()) {
+        return;
+    }
+
+    // file ids of the line table's file indexes, resolved on first use
+    std::vector<int64_t> ids{};
+    // the linker leaves sequences of functions it discarded at address 0
+    bool sequence_start = true;
+    bool discarded = false;
+    for (const auto &entry: lt) {
+        if (sequence_start) {
+            discarded = entry.address == 0;
+        }
+        sequence_start = entry.end_sequence;
+        if (discarded || !entry.is_stmt || entry.end_sequence || entry.line == 0) {
+            continue;
+        }
+        if (entry.file_index >= ids.size()) {
+            ids.resize(entry.file_index + 1, -1);
+        }
+        if (ids[entry.file_index] < 0) {
+            ids[entry.file_index] = file_id(normalize(entry.file->path));
+        }
+        m_rows.push_back({static_cast<uint32_t>(ids[entry.file_index]), entry.line, entry.address});
+    }
+}
+
+auto line_index::file_id(std::string path) -> uint32_t {
+    auto [it, added] = m_file_ids.try_emplace(path, static_cast<uint32_t>(m_paths.size()));
+    if (added) {
+        m_paths.push_back(std::move(path));
+    }
+    return it->second;
+}
+
+void line_index::merge(line_index &&shard) {
+    // the shard numbered its files on its own
+    std::vector<uint32_t> ids{};
+    ids.reserve(shard.m_paths.size());
+    for (auto &path: shard.m_paths) {
+        ids.push_back(file_id(std::move(path)));
+    }
+    m_rows.reserve(m_rows.size() + shard.m_rows.size());
+    for (const auto &r: shard.m_rows) {
+        m_rows.push_back({ids[r.file], r.line, r.address});
+    }
+    shard = line_index{};
+}
+
+void line_index::finalize() {
+    std::sort(m_rows.begin(), m_rows.end(), [](const row &a, const row &b) {
+        if (a.file != b.file) {
+            return a.file < b.file;
+        }
+        return a.line != b.line ? a.line < b.line : a.address < b.address;
+    });
+    m_rows.erase(std::unique(m_rows.begin(), m_rows.end(), [](const row &a, const row &b) {
+        return a.file == b.file && a.line == b.line && a.address == b.address;
+    }), m_rows.end());
+
+    std::vector<uint32_t> file_begin(m_paths.size() + 1, 0);
+    std::vector<unsigned> lines{};
+    std::vector<uint64_t> addresses{};
+    lines.reserve(m_rows.size());
+    addresses.reserve(m_rows.size());
+    for (const auto &r: m_rows) {
+        ++file_begin[r.file + 1];
+        lines.push_back(r.line);
+        addresses.push_back(r.address);
+    }
+    for (std::size_t f = 1; f < file_begin.size(); ++f) {
+        file_begin[f] += file_begin[f - 1];
+    }
+
+    std::vector<char> path_chars{};
+    std::vector<uint32_t> path_begin{0};
+    for (const auto &path: m_paths) {
+        path_chars.insert(path_chars.end(), path.begin(), path.end());
+        path_begin.push_back(static_cast<uint32_t>(path_chars.size()));
+    }
+    m_path_chars = flat_array{std::move(path_chars)};
+    m_path_begin = flat_array{std::move(path_begin)};
+
+    // files sorted by base name, so each group is a contiguous range
+    std::vector<uint32_t> files(m_paths.size());
+    for (uint32_t f = 0; f < files.size(); ++f) {
+        files[f] = f;
+    }
+    std::sort(files.begin(), files.end(), [this](uint32_t a, uint32_t b) {
+        auto base_a = basename(path(a)), base_b = basename(path(b));
+        return base_a != base_b ? base_a < base_b : a < b;
+    });
+    std::vector<uint32_t> basename_begin{};
+    for (uint32_t i = 0; i < files.size(); ++i) {
+        if (i == 0 || basename(path(files[i])) != basename(path(files[i - 1]))) {
+            basename_begin.push_back(i);
+        }
+    }
+    auto n_groups = static_cast<uint32_t>(basename_begin.size());
+    basename_begin.push_back(static_cast<uint32_t>(files.size()));
+    m_basename_files = flat_array{std::move(files)};
+    m_basename_begin = flat_array{std::move(basename_begin)};
+    m_basename_slots = flat_array{string_slots::build(n_groups, [this](uint32_t g) {
+        return basename_group(g);
+    })};
+
+    m_file_begin = flat_array{std::move(file_begin)};
+    m_lines = flat_array{std::move(lines)};
+    m_addresses = flat_array{std::move(addresses)};
+
+    m_rows.clear();
+    m_rows.shrink_to_fit();
+    m_paths.clear();
+    m_paths.shrink_to_fit();
+    m_file_ids.clear();
+}
+
+void line_index::save(index_cache::writer &out) const {
+    out.add(m_path_chars.span());
+    out.add(m_path_begin.span());
+    out.add(m_basename_files.span());
+    out.add(m_basename_begin.span());
+    out.add(m_basename_slots.span());
+    out.add(m_file_begin.span());
+    out.add(m_lines.span());
+    out.add(m_addresses.span());
+}
+
+void line_index::load(index_cache::reader &in) {
+    m_path_chars = flat_array{in.next<char>()};
+    m_path_begin = flat_array{in.next<uint32_t>()};
+    m_basename_files = flat_array{in.next<uint32_t>()};
+    m_basename_begin = flat_array{in.next<uint32_t>()};
+    m_basename_slots = flat_array{in.next<uint32_t>()};
+    m_file_begin = flat_array{in.next<uint32_t>()};
+    m_lines = flat_array{in.next<unsigned>()};
+    m_addresses = flat_array{in.next<uint64_t>()};
+
+    // the lookups index with these without checking
+    auto valid_offsets = [](const flat_array<uint32_t> &begin, std::size_t n) {
+        return !begin.empty() && begin[0] == 0 && begin[begin.size() - 1] == n &&
+               std::is_sorted(begin.begin(), begin.end());
+    };
+    auto n_files = m_path_begin.size() - 1;
+    auto slots = m_basename_slots.span();
+    if (!valid_offsets(m_path_begin, m_path_chars.size()) ||
+        !valid_offsets(m_basename_begin, m_basename_files.size()) ||
+        m_basename_files.size() != n_files || m_file_begin.size() != n_files + 1 ||
+        !valid_offsets(m_file_begin, m_lines.size()) || m_addresses.size() != m_lines.size() ||
+        std::any_of(m_basename_files.begin(), m_basename_files.end(), [&](uint32_t f) { return f >= n_files; }) ||
+        slots.empty() || (slots.size() & (slots.size() - 1)) != 0 ||
+        std::any_of(slots.begin(), slots.end(), [&](uint32_t g) {
+            return g != string_slots::empty && g + 1 >= m_basename_begin.size();
+        })) {
+        throw index_cache::format_error{"line index tables are inconsistent"};
+    }
+}
+
+auto line_index::path(uint32_t file) const -> std::string_view {
+    return {m_path_chars.span().data() + m_path_begin[file], m_path_begin[file + 1] - m_path_begin[file]};
+}
+
+auto line_index::basename_group(uint32_t group) const -> std::string_view {
+    return basename(path(m_basename_files[m_basename_begin[group]]));
+}
+
+auto line_index::find(const std::string &file, unsigned line) const -> std::vector<uint64_t> {
+    auto query = normalize(file);
+    auto group = string_slots::find(m_basename_slots.span(), basename(query), [this](uint32_t g) {
+        return basename_group(g);
+    });
+    if (!group) {
+        return {};
+    }
+
+    std::vector<uint64_t> addrs{};
+    for (auto i = m_basename_begin[*group]; i < m_basename_begin[*group + 1]; ++i) {
+        auto f = m_basename_files[i];
+        if (!matches(path(f), query)) {
+            continue;
+        }
+        auto first = m_lines.begin() + m_file_begin[f];
+        auto last = m_lines.begin() + m_file_begin[f + 1];
+        auto [lo, hi] = std::equal_range(first, last, line);
+        addrs.insert(addrs.end(), m_addresses.begin() + (lo - m_lines.begin()),
+                     m_addresses.begin() + (hi - m_lines.begin()));
+    }
+    std::sort(addrs.begin(), addrs.end());
+    addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+    return addrs;
+}
+
+auto line_index::empty() const -> bool {
+    return m_addresses.empty();
+}
@@ -6,21 +6,35 @@
 #include "../include/debugger.h"
 #include <sys/ptrace.h>
 #include <iostream>
+#include <string>
 #include <zconf.h>
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
+    // debugger [--agent path/to/libdebugger_agent.so] program
+    const char *agent = nullptr;
+    int arg = 1;
+    if (argc > 2 && std::string{argv[1]} == "--agent") {
+        agent = argv[2];
+        arg = 3;
+    }
+
+    if (argc <= arg) {
         std::cerr << "Program name not specified";
         return -1;
     }
 
-    auto prog = argv[1];
+    auto prog = argv[arg];
     auto pid = fork();
 
     if (pid == 0) {
         // we're in the child
         // exec debugee
 
+        // the agent serves the fast tracepoints from inside the debugee
+        if (agent) {
+            setenv("LD_PRELOAD", agent, 1);
+        }
+
         //PTRACE_TRACEME in linux systems
         ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
         execl(prog, prog, nullptr);
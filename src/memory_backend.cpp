@@ -0,0 +1,77 @@
+#include <sys/ptrace.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include "../include/memory_backend.h"
+
+ptrace_backend::ptrace_backend(pid_t pid) : m_pid{pid} {
+}
+
+auto ptrace_backend::read(uint64_t address, const iovec *local, std::size_t count) -> std::size_t {
+    std::size_t length = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        length += local[i].iov_len;
+    }
+    iovec remote{reinterpret_cast<void *>(address), length};
+
+    auto nread = process_vm_readv(m_pid, local, count, &remote, 1, 0);
+    return nread > 0 ? static_cast<std::size_t>(nread) : 0;
+}
+
+auto ptrace_backend::write(uint64_t address, const void *buffer, std::size_t length) -> bool {
+    auto in = static_cast<const uint8_t *>(buffer);
+    auto end = address + length;
+
+    // POKEDATA only writes whole words, partial words at either end of the
+    // range are read back first and patched
+    for (auto word = address & ~uint64_t{7}; word < end; word += sizeof(uint64_t)) {
+        auto from = std::max(word, address);
+        auto to = std::min(word + sizeof(uint64_t), end);
+
+        uint64_t data{};
+        if (to - from != sizeof(uint64_t)) {
+            data = ptrace(PTRACE_PEEKDATA, m_pid, word, nullptr);
+        }
+        std::memcpy(reinterpret_cast<uint8_t *>(&data) + (from - word), in + (from - address), to - from);
+        if (ptrace(PTRACE_POKEDATA, m_pid, word, data) == -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+auto ptrace_backend::name() const -> const char * {
+    return "ptrace";
+}
+
+proc_mem_backend::proc_mem_backend(int fd) : m_fd{fd} {
+}
+
+proc_mem_backend::~proc_mem_backend() {
+    close(m_fd);
+}
+
+auto proc_mem_backend::open(pid_t pid) -> std::unique_ptr<proc_mem_backend> {
+    auto path = "/proc/" + std::to_string(pid) + "/mem";
+    auto fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd == -1) {
+        return nullptr;
+    }
+    return std::make_unique<proc_mem_backend>(fd);
+}
+
+auto proc_mem_backend::read(uint64_t address, const iovec *local, std::size_t count) -> std::size_t {
+    auto nread = preadv(m_fd, local, static_cast<int>(count), static_cast<off_t>(address));
+    return nread > 0 ? static_cast<std::size_t>(nread) : 0;
+}
+
+auto proc_mem_backend::write(uint64_t address, const void *buffer, std::size_t length) -> bool {
+    auto nwritten = pwrite(m_fd, buffer, length, static_cast<off_t>(address));
+    return nwritten == static_cast<ssize_t>(length);
+}
+
+auto proc_mem_backend::name() const -> const char * {
+    return "/proc/pid/mem";
+}
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include "../include/pc_index.h"
+
+namespace {
+    bool is_code_scope(dwarf::DW_TAG tag) {
+        return tag == dwarf::DW_TAG::subprogram || tag == dwarf::DW_TAG::inlined_subroutine ||
+               tag == dwarf::DW_TAG::lexical_block;
+    }
+
+    // DIEs whose children may contain code scopes
+    bool may_contain_scopes(dwarf::DW_TAG tag) {
+        return is_code_scope(tag) || tag == dwarf::DW_TAG::namespace_ || tag == dwarf::DW_TAG::class_type ||
+               tag == dwarf::DW_TAG::structure_type || tag == dwarf::DW_TAG::union_type;
+    }
+}
+
+void pc_index::add_unit(const dwarf::unit &cu) {
+    add_scopes(cu.root(), std::nullopt, std::nullopt);
+}
+
+void pc_index::add_scopes(const dwarf::die &parent, std::optional<dwarf::section_offset> function,
+                          std::optional<dwarf::section_offset> instance) {
+    for (const auto &die: parent) {
+        if (!may_contain_scopes(die.tag)) {
+            continue;
+        }
+
+        auto inner = function;
+        auto inner_instance = instance;
+        if (is_code_scope(die.tag) && (die.has(dwarf::DW_AT::low_pc) || die.has(dwarf::DW_AT::ranges))) {
+            auto offset = die.get_section_offset();
+            if (die.tag == dwarf::DW_TAG::subprogram) {
+                inner = offset;
+            }
+            if (die.tag != dwarf::DW_TAG::lexical_block) {
+                inner_instance = offset;
+            }
+            // an inlined subroutine or block outside of a subprogram is
+            // malformed, attribute it to itself
+            auto owner = inner.value_or(offset);
+            for (const auto &range: die_pc_range(die)) {
+                if (range.low < range.high) {
+                    m_scopes.push_back({range.low, range.high, offset, owner, inner_instance.value_or(offset)});
+                }
+            }
+        }
+        add_scopes(die, inner, inner_instance);
+    }
+}
+
+void pc_index::merge(pc_index &&shard) {
+    m_scopes.insert(m_scopes.end(), shard.m_scopes.begin(), shard.m_scopes.end());
+    shard.m_scopes.clear();
+}
+
+// Sweeps the scopes ordered by start address, outer scopes first, keeping the
+// open scopes on a stack. Whatever part of an address range is not covered
+// by a nested scope belongs to the scope below it on the stack.
+void pc_index::finalize() {
+    // identical ranges come from the copies of a COMDAT function which the
+    // linker pointed at the copy it kept, order them by DIE so the result
+    // doesn't depend on the order the units were added in
+    std::sort(m_scopes.begin(), m_scopes.end(), [](const scope &a, const scope &b) {
+        if (a.low != b.low) {
+            return a.low < b.low;
+        }
+        return a.high != b.high ? a.high > b.high : a.die < b.die;
+    });
+
+    std::vector<uint64_t> lows{};
+    std::vector<uint64_t> highs{};
+    std::vector<dwarf::section_offset> dies{};
+    std::vector<dwarf::section_offset> functions{};
+    std::vector<dwarf::section_offset> instances{};
+
+    std::vector<scope> open{};
+    uint64_t cur = 0;
+
+    auto emit = [&](uint64_t to) {
+        if (open.empty() || cur >= to) {
+            return;
+        }
+        const auto &s = open.back();
+        // extend the previous segment if it belongs to the same scope
+        if (!lows.empty() && highs.back() == cur && dies.back() == s.die) {
+            highs.back() = to;
+        } else {
+            lows.push_back(cur);
+            highs.push_back(to);
+            dies.push_back(s.die);
+            functions.push_back(s.function);
+            instances.push_back(s.instance);
+        }
+        cur = to;
+    };
+
+    for (auto s: m_scopes) {
+        while (!open.empty() && open.back().high <= s.low) {
+            emit(open.back().high);
+            open.pop_back();
+        }
+        emit(s.low);
+        cur = std::max(cur, s.low);
+        // a scope leaking out of its parent is clipped to it
+        if (!open.empty()) {
+            s.high = std::min(s.high, open.back().high);
+        }
+        open.push_back(s);
+    }
+    while (!open.empty()) {
+        emit(open.back().high);
+        open.pop_back();
+    }
+
+    m_lows = flat_array{std::move(lows)};
+    m_highs = flat_array{std::move(highs)};
+    m_dies = flat_array{std::move(dies)};
+    m_functions = flat_array{std::move(functions)};
+    m_instances = flat_array{std::move(instances)};
+    m_scopes.clear();
+    m_scopes.shrink_to_fit();
+}
+
+void pc_index::save(index_cache::writer &out) const {
+    out.add(m_lows.span());
+    out.add(m_highs.span());
+    out.add(m_dies.span());
+    out.add(m_functions.span());
+    out.add(m_instances.span());
+}
+
+void pc_index::load(index_cache::reader &in) {
+    m_lows = flat_array{in.next<uint64_t>()};
+    m_highs = flat_array{in.next<uint64_t>()};
+    m_dies = flat_array{in.next<dwarf::section_offset>()};
+    m_functions = flat_array{in.next<dwarf::section_offset>()};
+    m_instances = flat_array{in.next<dwarf::section_offset>()};
+    auto n = m_lows.size();
+    if (m_highs.size() != n || m_dies.size() != n || m_functions.size() != n || m_instances.size() != n) {
+        throw index_cache::format_error{"pc index arrays differ in size"};
+    }
+}
+
+auto pc_index::find(uint64_t pc) const -> std::optional<std::size_t> {
+    auto it = std::upper_bound(m_lows.begin(), m_lows.end(), pc);
+    if (it == m_lows.begin()) {
+        return std::nullopt;
+    }
+    auto i = static_cast<std::size_t>(it - m_lows.begin()) - 1;
+    if (pc >= m_highs[i]) {
+        return std::nullopt;
+    }
+    return i;
+}
+
+auto pc_index::function_at(uint64_t pc) const -> std::optional<dwarf::section_offset> {
+    if (auto i = find(pc)) {
+        return m_functions[*i];
+    }
+    return std::nullopt;
+}
+
+auto pc_index::instance_at(uint64_t pc) const -> std::optional<dwarf::section_offset> {
+    if (auto i = find(pc)) {
+        return m_instances[*i];
+    }
+    return std::nullopt;
+}
+
+auto pc_index::scope_at(uint64_t pc) const -> std::optional<dwarf::section_offset> {
+    if (auto i = find(pc)) {
+        return m_dies[*i];
+    }
+    return std::nullopt;
+}
+
+auto pc_index::empty() const -> bool {
+    return m_lows.empty();
+}
@@ -0,0 +1,147 @@
+#include <sys/ptrace.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "../include/target_memory.h"
+
+namespace {
+    constexpr uint64_t page_mask = target_memory::page_size - 1;
+    // nothing is ever mapped in the last page, keeping ranges below it means
+    // the page loops don't have to handle wrapping around the address space
+    constexpr uint64_t top_page = ~page_mask;
+
+    // cannot write ... at 0x...
+    std::runtime_error write_error(uint64_t address, std::size_t length) {
+        std::ostringstream what{};
+        what << "cannot write " << length << " bytes at 0x" << std::hex << address;
+        return std::runtime_error{what.str()};
+    }
+    constexpr std::size_t max_iov = IOV_MAX;
+}
+
+target_memory::target_memory(pid_t pid) : m_pid{pid}, m_backend{proc_mem_backend::open(pid)}, m_ptrace{pid} {
+    if (!m_backend) {
+        m_backend = std::make_unique<ptrace_backend>(pid);
+    }
+}
+
+void target_memory::read(uint64_t address, void *buffer, std::size_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (address >= top_page || length > top_page - address) {
+        // unreadable like any unmapped page, which ptrace peeks as all ones
+        auto below = address >= top_page ? 0 : top_page - address;
+        read(address, buffer, below);
+        std::memset(static_cast<uint8_t *>(buffer) + below, 0xff, length - below);
+        return;
+    }
+
+    auto first = address & ~page_mask;
+    auto last = (address + length - 1) & ~page_mask;
+    fetch_pages(first, last);
+
+    auto out = static_cast<uint8_t *>(buffer);
+    for (auto base = first; base <= last; base += page_size) {
+        auto from = std::max(base, address);
+        auto to = std::min(base + page_size, address + length);
+        std::memcpy(out + (from - address), m_pages.at(base).data() + (from - base), to - from);
+    }
+}
+
+uint64_t target_memory::read_word(uint64_t address) {
+    uint64_t value{};
+    read(address, &value, sizeof(value));
+    return value;
+}
+
+uint8_t target_memory::read_byte(uint64_t address) {
+    uint8_t value{};
+    read(address, &value, sizeof(value));
+    return value;
+}
+
+void target_memory::write(uint64_t address, const void *buffer, std::size_t length) {
+    if (address >= top_page || length > top_page - address) {
+        throw write_error(address, length);
+    }
+    bool written = m_backend->write(address, buffer, length) || m_ptrace.write(address, buffer, length);
+
+    // keep the cached copies of the touched pages coherent. A failed write
+    // may have changed part of the range, so they are fetched again.
+    auto in = static_cast<const uint8_t *>(buffer);
+    for (auto base = address & ~page_mask; base < address + length; base += page_size) {
+        auto it = m_pages.find(base);
+        if (it == m_pages.end()) {
+            continue;
+        }
+        if (!written) {
+            m_pages.erase(it);
+            continue;
+        }
+        auto from = std::max(base, address);
+        auto to = std::min(base + page_size, address + length);
+        std::memcpy(it->second.data() + (from - base), in + (from - address), to - from);
+    }
+
+    if (!written) {
+        throw write_error(address, length);
+    }
+}
+
+void target_memory::write_word(uint64_t address, uint64_t value) {
+    write(address, &value, sizeof(value));
+}
+
+void target_memory::invalidate() {
+    m_pages.clear();
+}
+
+auto target_memory::backend_name() const -> const char * {
+    return m_backend->name();
+}
+
+// fetch every page in [first, last] which is not cached yet, contiguous runs
+// of missing pages are read with a single backend call
+void target_memory::fetch_pages(uint64_t first, uint64_t last) {
+    std::vector<uint64_t> missing{};
+    for (auto base = first; base <= last; base += page_size) {
+        if (!m_pages.count(base)) {
+            missing.push_back(base);
+        }
+    }
+
+    std::size_t i = 0;
+    while (i < missing.size()) {
+        std::size_t n = 1;
+        while (i + n < missing.size() && n < max_iov && missing[i + n] == missing[i] + n * page_size) {
+            ++n;
+        }
+
+        std::vector<iovec> local(n);
+        for (std::size_t k = 0; k < n; ++k) {
+            local[k] = {m_pages[missing[i + k]].data(), page_size};
+        }
+
+        auto done = m_backend->read(missing[i], local.data(), n) / page_size;
+        i += done;
+
+        if (done < n) {
+            // process_vm_readv honours the page protections of the tracee
+            // while ptrace does not, so fall back to peeking the page which
+            // the backend failed to read
+            peek_page(missing[i], m_pages[missing[i]]);
+            ++i;
+        }
+    }
+}
+
+void target_memory::peek_page(uint64_t base, page &p) {
+    for (std::size_t off = 0; off < page_size; off += sizeof(uint64_t)) {
+        auto data = ptrace(PTRACE_PEEKDATA, m_pid, base + off, nullptr);
+        std::memcpy(p.data() + off, &data, sizeof(data));
+    }
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+#include "../include/thread_pool.h"
+
+thread_pool::thread_pool(std::size_t n_workers) {
+    if (n_workers == 0) {
+        n_workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (std::size_t i = 0; i < n_workers; ++i) {
+        m_queues.push_back(std::make_unique<queue>());
+    }
+    for (std::size_t i = 1; i < n_workers; ++i) {
+        m_threads.emplace_back(&thread_pool::worker, this, i);
+    }
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto &t: m_threads) {
+        t.join();
+    }
+}
+
+auto thread_pool::size() const -> std::size_t {
+    return m_queues.size();
+}
+
+void thread_pool::run(std::size_t n_tasks, const std::function<void(std::size_t, std::size_t)> &fn) {
+    for (std::size_t i = 0; i < n_tasks; ++i) {
+        auto &q = *m_queues[i % m_queues.size()];
+        std::lock_guard<std::mutex> lock{q.mutex};
+        q.tasks.push_back(i);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_fn = &fn;
+        m_error = nullptr;
+        m_failed.store(false, std::memory_order_relaxed);
+        m_running = m_queues.size();
+        ++m_batch;
+    }
+    m_wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock{m_mutex};
+    m_done.wait(lock, [this] { return m_running == 0; });
+    m_fn = nullptr;
+    if (m_error) {
+        std::rethrow_exception(m_error);
+    }
+}
+
+void thread_pool::worker(std::size_t id) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            m_wake.wait(lock, [&] { return m_stop || m_batch != seen; });
+            if (m_stop) {
+                return;
+            }
+            seen = m_batch;
+        }
+        work(id);
+    }
+}
+
+// runs tasks until no queue has any left, then reports this worker as done
+void thread_pool::work(std::size_t id) {
+    while (auto task = take(id)) {
+        try {
+            (*m_fn)(*task, id);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            if (!m_error) {
+                m_error = std::current_exception();
+            }
+            m_failed.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+    if (--m_running == 0) {
+        m_done.notify_all();
+    }
+}
+
+// the oldest task of our own queue, otherwise the newest one of another
+auto thread_pool::take(std::size_t id) -> std::optional<std::size_t> {
+    if (m_failed.load(std::memory_order_relaxed)) {
+        // a task threw, drop the rest of the batch
+        for (auto &q: m_queues) {
+            std::lock_guard<std::mutex> lock{q->mutex};
+            q->tasks.clear();
+        }
+        return std::nullopt;
+    }
+
+    for (std::size_t i = 0; i < m_queues.size(); ++i) {
+        auto &q = *m_queues[(id + i) % m_queues.size()];
+        std::lock_guard<std::mutex> lock{q.mutex};
+        if (q.tasks.empty()) {
+            continue;
+        }
+        std::size_t task;
+        if (i == 0) {
+            task = q.tasks.front();
+            q.tasks.pop_front();
+        } else {
+            task = q.tasks.back();
+            q.tasks.pop_back();
+        }
+        return task;
+    }
+    return std::nullopt;
+}
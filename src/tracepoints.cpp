@@ -0,0 +1,312 @@
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include "../include/registers.h"
+#include "../include/tracepoints.h"
+#include "../include/x86_decoder.h"
+
+namespace {
+    constexpr std::size_t jmp_size = 5;
+
+    void append(std::vector<uint8_t> &code, std::initializer_list<uint8_t> bytes) {
+        code.insert(code.end(), bytes);
+    }
+
+    template<typename T>
+    void append_value(std::vector<uint8_t> &code, T value) {
+        auto *p = reinterpret_cast<const uint8_t *>(&value);
+        code.insert(code.end(), p, p + sizeof(value));
+    }
+
+    std::optional<int32_t> rel32(int64_t value) {
+        if (value < INT32_MIN || value > INT32_MAX) {
+            return std::nullopt;
+        }
+        return static_cast<int32_t>(value);
+    }
+
+    // Copies whole instructions from the start of code until at least
+    // jmp_size bytes are covered, so they can run at `to` instead of `from`.
+    // RIP-relative operands and relative branches are retargeted, short
+    // branches are widened to rel32. A control transfer has to be the last
+    // instruction, since what follows it may be reached from elsewhere.
+    // Returns the relocated code and the number of bytes covered.
+    std::pair<std::vector<uint8_t>, std::size_t>
+    relocate(const uint8_t *code, std::size_t size, uint64_t from, uint64_t to) {
+        std::vector<uint8_t> out{};
+        std::size_t covered = 0;
+
+        while (covered < jmp_size) {
+            auto insn = decode_x86_instruction(code + covered, size - covered);
+            if (!insn || insn->flow == x86_flow::unsupported) {
+                std::ostringstream what{};
+                what << "cannot relocate the instruction at 0x" << std::hex << from + covered;
+                throw std::runtime_error{what.str()};
+            }
+            if (insn->flow != x86_flow::sequential && covered + insn->length < jmp_size) {
+                throw std::runtime_error{"control transfer within the patched bytes"};
+            }
+
+            std::vector<uint8_t> bytes(code + covered, code + covered + insn->length);
+            auto src = from + covered;
+            auto dst = to + out.size();
+
+            if (insn->rip_disp_offset) {
+                int32_t disp{};
+                std::memcpy(&disp, bytes.data() + insn->rip_disp_offset, sizeof(disp));
+                auto fixed = rel32(disp + static_cast<int64_t>(src - dst));
+                if (!fixed) {
+                    throw std::runtime_error{"RIP-relative operand out of reach of the jump pad"};
+                }
+                std::memcpy(bytes.data() + insn->rip_disp_offset, &*fixed, sizeof(*fixed));
+            }
+
+            if (insn->rel_size == 1) {
+                auto opcode = bytes[bytes.size() - 2];
+                auto target = src + insn->length + static_cast<int8_t>(bytes.back());
+                if (opcode == 0xeb) {
+                    bytes = {0xe9, 0, 0, 0, 0};
+                } else if (opcode >= 0x70 && opcode <= 0x7f) {
+                    bytes = {0x0f, static_cast<uint8_t>(opcode + 0x10), 0, 0, 0, 0};
+                } else {
+                    throw std::runtime_error{"loop/jrcxz can't be relocated"};
+                }
+                auto rel = rel32(static_cast<int64_t>(target - (dst + bytes.size())));
+                if (!rel) {
+                    throw std::runtime_error{"branch target out of reach of the jump pad"};
+                }
+                std::memcpy(bytes.data() + bytes.size() - 4, &*rel, sizeof(*rel));
+            } else if (insn->rel_size == 4) {
+                int32_t disp{};
+                std::memcpy(&disp, bytes.data() + bytes.size() - 4, sizeof(disp));
+                auto target = src + insn->length + disp;
+                auto rel = rel32(static_cast<int64_t>(target - (dst + bytes.size())));
+                if (!rel) {
+                    throw std::runtime_error{"branch target out of reach of the jump pad"};
+                }
+                std::memcpy(bytes.data() + bytes.size() - 4, &*rel, sizeof(*rel));
+            }
+
+            out.insert(out.end(), bytes.begin(), bytes.end());
+            covered += insn->length;
+        }
+        return {out, covered};
+    }
+}
+
+std::unique_ptr<trace_agent> trace_agent::attach(pid_t pid) {
+    auto name = trace_ring::shm_name(pid);
+    auto fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto *p = mmap(nullptr, sizeof(trace_ring::header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto *ring = static_cast<trace_ring::header *>(p);
+    if (ring->magic != trace_ring::magic || ring->version != trace_ring::version) {
+        munmap(p, sizeof(trace_ring::header));
+        return nullptr;
+    }
+    // both sides have it mapped now, nobody needs the name any more
+    shm_unlink(name.c_str());
+    return std::make_unique<trace_agent>(ring, sizeof(trace_ring::header));
+}
+
+trace_agent::trace_agent(trace_ring::header *ring, std::size_t ring_size)
+        : m_ring{ring}, m_ring_size{ring_size}, m_drain{&trace_agent::drain, this} {
+}
+
+trace_agent::~trace_agent() {
+    m_stop = true;
+    m_drain.join();
+    munmap(m_ring, m_ring_size);
+}
+
+// jump pad layout:
+//   lea rsp, [rsp - 128]     keep out of the red zone
+//   push id
+//   call [rip + trampoline]
+//   lea rsp, [rsp + 8]       lea instead of add, the flags have been restored
+//   lea rsp, [rsp + 128]
+//   <relocated instructions>
+//   jmp addr + covered
+//   trampoline: .quad
+void trace_agent::add(target_memory &memory, std::intptr_t addr, uint64_t pc, std::vector<trace_capture> captures) {
+    if (m_tracepoints.count(addr)) {
+        throw std::runtime_error{"there is a tracepoint at this address already"};
+    }
+    if (m_next_id >= trace_ring::max_tracepoints) {
+        throw std::runtime_error{"out of tracepoint slots"};
+    }
+    if (captures.size() > trace_ring::max_captures) {
+        throw std::runtime_error{"at most " + std::to_string(trace_ring::max_captures) + " captures per tracepoint"};
+    }
+
+    auto id = m_next_id;
+    auto pad = m_ring->pad_area + id * trace_ring::pad_slot_size;
+
+    std::vector<uint8_t> code{};
+    append(code, {0x48, 0x8d, 0x64, 0x24, 0x80});
+    code.push_back(0x68);
+    append_value(code, static_cast<uint32_t>(id));
+    append(code, {0xff, 0x15});
+    auto trampoline_disp_at = code.size();
+    append_value(code, int32_t{0});
+    append(code, {0x48, 0x8d, 0x64, 0x24, 0x08});
+    append(code, {0x48, 0x8d, 0xa4, 0x24, 0x80, 0x00, 0x00, 0x00});
+
+    std::array<uint8_t, 2 * x86_max_instruction_length> original{};
+    memory.read(addr, original.data(), original.size());
+    auto [relocated, covered] = relocate(original.data(), original.size(), addr, pad + code.size());
+    if (pc > static_cast<uint64_t>(addr) && pc < addr + covered) {
+        throw std::runtime_error{"the pc is inside the instructions to patch"};
+    }
+    code.insert(code.end(), relocated.begin(), relocated.end());
+
+    code.push_back(0xe9);
+    auto back = rel32(static_cast<int64_t>(addr + covered - (pad + code.size() + 4)));
+    if (!back) {
+        throw std::runtime_error{"the jump pad area is out of reach"};
+    }
+    append_value(code, *back);
+
+    while (code.size() % sizeof(uint64_t)) {
+        code.push_back(0xcc);
+    }
+    int32_t trampoline_disp = static_cast<int32_t>(code.size() - (trampoline_disp_at + 4));
+    std::memcpy(code.data() + trampoline_disp_at, &trampoline_disp, sizeof(trampoline_disp));
+    append_value(code, m_ring->trampoline);
+    if (code.size() > trace_ring::pad_slot_size) {
+        throw std::runtime_error{"jump pad too large"};
+    }
+
+    auto jmp = rel32(static_cast<int64_t>(pad - (addr + jmp_size)));
+    if (!jmp) {
+        throw std::runtime_error{"the jump pad area is out of reach"};
+    }
+
+    // the descriptor and the pad have to be in place before the jmp is
+    std::vector<std::string> names{};
+    auto &desc = m_ring->tracepoints[id];
+    desc.addr = addr;
+    desc.n_captures = static_cast<uint32_t>(captures.size());
+    for (std::size_t i = 0; i < captures.size(); ++i) {
+        const auto &var = captures[i].var;
+        desc.captures[i] = {var.base ? static_cast<int32_t>(*var.base) : -1, static_cast<uint32_t>(var.size),
+                            var.offset, var.is_signed, 0};
+        names.push_back(captures[i].name);
+    }
+    memory.write(pad, code.data(), code.size());
+
+    std::vector<uint8_t> patch{0xe9};
+    append_value(patch, *jmp);
+    // fill the rest of the last instruction, nothing may jump into it
+    patch.resize(covered, 0xcc);
+    memory.write(addr, patch.data(), patch.size());
+
+    std::lock_guard<std::mutex> lock{m_mutex};
+    m_tracepoints[addr] = tracepoint{addr, id, {original.begin(), original.begin() + covered}, std::move(names)};
+    m_addr_by_id[id] = addr;
+    ++m_next_id;
+}
+
+// the pad slot is not reused, a thread of the tracee may still be inside it
+void trace_agent::remove(target_memory &memory, std::intptr_t addr, uint64_t pc) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto it = m_tracepoints.find(addr);
+    if (it == m_tracepoints.end()) {
+        throw std::runtime_error{"no tracepoint at this address"};
+    }
+    if (pc > static_cast<uint64_t>(addr) && pc < addr + it->second.original.size()) {
+        throw std::runtime_error{"the pc is inside the patched instructions"};
+    }
+    memory.write(addr, it->second.original.data(), it->second.original.size());
+    m_tracepoints.erase(it);
+}
+
+auto trace_agent::patched_at(std::intptr_t addr) -> std::optional<std::intptr_t> {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    for (const auto &[start, tp]: m_tracepoints) {
+        if (addr >= start && addr < start + static_cast<std::intptr_t>(tp.original.size())) {
+            return start;
+        }
+    }
+    return std::nullopt;
+}
+
+void trace_agent::discard(pid_t pid) {
+    shm_unlink(trace_ring::shm_name(pid).c_str());
+}
+
+void trace_agent::drain() {
+    using namespace std::chrono_literals;
+
+    while (!m_stop) {
+        auto tail = m_ring->tail.load(std::memory_order_relaxed);
+        auto &slot = m_ring->records[tail % trace_ring::n_records];
+        if (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+            std::this_thread::sleep_for(1ms);
+            continue;
+        }
+
+        record r{slot.tracepoint, slot.tid, {}, {}};
+        std::memcpy(r.regs, slot.regs, sizeof(r.regs));
+        std::memcpy(r.values, slot.values, sizeof(r.values));
+        m_ring->tail.store(tail + 1, std::memory_order_release);
+
+        std::lock_guard<std::mutex> lock{m_mutex};
+        ++m_drained;
+        if (auto it = m_addr_by_id.find(r.id); it != m_addr_by_id.end()) {
+            if (auto tp = m_tracepoints.find(it->second); tp != m_tracepoints.end()) {
+                ++tp->second.hits;
+            }
+        }
+        m_records.push_back(r);
+        if (m_records.size() > max_kept_records) {
+            m_records.pop_front();
+        }
+    }
+}
+
+void trace_agent::print_status(std::ostream &out) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    for (const auto &[addr, tp]: m_tracepoints) {
+        out << "tracepoint " << std::dec << tp.id << " at 0x" << std::hex << addr
+            << ": " << std::dec << tp.hits << " hits" << std::endl;
+    }
+    auto head = m_ring->head.load(std::memory_order_relaxed);
+    auto tail = m_ring->tail.load(std::memory_order_relaxed);
+    out << std::dec << m_drained << " records drained, " << head - tail << " pending, "
+        << m_ring->dropped.load(std::memory_order_relaxed) << " dropped" << std::endl;
+}
+
+void trace_agent::print_records(std::ostream &out, std::size_t n) {
+    std::lock_guard<std::mutex> lock{m_mutex};
+    auto first = m_records.size() > n ? m_records.size() - n : 0;
+    for (auto i = first; i < m_records.size(); ++i) {
+        const auto &r = m_records[i];
+        auto addr = m_addr_by_id.count(r.id) ? m_addr_by_id.at(r.id) : 0;
+        out << "0x" << std::hex << addr << std::dec << " tid " << r.tid;
+        for (auto reg_: {reg::rdi, reg::rsi, reg::rdx, reg::rsp}) {
+            out << ' ' << get_register_name(reg_) << "=0x" << std::hex << r.regs[static_cast<int>(reg_)];
+        }
+        auto tp = m_tracepoints.find(addr);
+        if (tp != m_tracepoints.end()) {
+            for (std::size_t k = 0; k < tp->second.names.size(); ++k) {
+                out << ' ' << tp->second.names[k] << '=' << std::dec << static_cast<int64_t>(r.values[k]);
+            }
+        }
+        out << std::endl;
+    }
+}
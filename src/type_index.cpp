@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include "../include/type_index.h"
+
+namespace {
+    bool is_type(dwarf::DW_TAG tag) {
+        return tag == dwarf::DW_TAG::class_type || tag == dwarf::DW_TAG::structure_type ||
+               tag == dwarf::DW_TAG::union_type || tag == dwarf::DW_TAG::enumeration_type;
+    }
+
+    // DIEs whose children may be named types
+    bool is_scope(dwarf::DW_TAG tag) {
+        return tag == dwarf::DW_TAG::namespace_ || tag == dwarf::DW_TAG::class_type ||
+               tag == dwarf::DW_TAG::structure_type || tag == dwarf::DW_TAG::union_type;
+    }
+}
+
+void type_index::add_unit(const dwarf::compilation_unit &cu) {
+    add_dies(cu.root(), {});
+}
+
+void type_index::add_dies(const dwarf::die &parent, const std::string &scope) {
+    // the variables in a class are static member declarations, which are
+    // defined at namespace scope
+    bool namespace_scope = !is_type(parent.tag);
+    for (const auto &die: parent) {
+        if (die.tag == dwarf::DW_TAG::variable && namespace_scope && die.has(dwarf::DW_AT::name)) {
+            auto name = scope.empty() ? at_name(die) : scope + "::" + at_name(die);
+            m_variables.push_back({name, die.get_section_offset(), die.has(dwarf::DW_AT::declaration)});
+            continue;
+        }
+        if (!is_type(die.tag) && !is_scope(die.tag)) {
+            continue;
+        }
+        // anonymous namespaces and classes don't qualify the names in them,
+        // and an anonymous type can't be named
+        auto inner = scope;
+        if (die.has(dwarf::DW_AT::name)) {
+            inner = scope.empty() ? at_name(die) : scope + "::" + at_name(die);
+            if (is_type(die.tag)) {
+                bool declaration = die.has(dwarf::DW_AT::declaration);
+                (declaration ? m_declarations : m_definitions).push_back({inner, die.get_section_offset(),
+                                                                          declaration});
+            }
+        }
+        if (is_scope(die.tag)) {
+            add_dies(die, inner);
+        }
+    }
+}
+
+void type_index::merge(type_index &&shard) {
+    for (auto [from, to]: {std::pair{&shard.m_definitions, &m_definitions},
+                           std::pair{&shard.m_declarations, &m_declarations},
+                           std::pair{&shard.m_variables, &m_variables}}) {
+        to->insert(to->end(), std::make_move_iterator(from->begin()), std::make_move_iterator(from->end()));
+    }
+    shard = type_index{};
+}
+
+void type_index::finalize() {
+    // every unit which uses a type defines it again, keep the first
+    m_types.build(m_definitions);
+    m_globals.build(m_variables);
+
+    std::vector<std::pair<uint64_t, uint64_t>> resolved{};
+    for (const auto &t: m_declarations) {
+        if (auto definition = find(t.name)) {
+            resolved.emplace_back(t.offset, *definition);
+        }
+    }
+    std::sort(resolved.begin(), resolved.end());
+    std::vector<uint64_t> declaration_offsets{};
+    std::vector<uint64_t> declaration_definitions{};
+    for (const auto &[declaration, definition]: resolved) {
+        declaration_offsets.push_back(declaration);
+        declaration_definitions.push_back(definition);
+    }
+    m_declaration_offsets = flat_array{std::move(declaration_offsets)};
+    m_declaration_definitions = flat_array{std::move(declaration_definitions)};
+
+    for (auto *collected: {&m_definitions, &m_declarations, &m_variables}) {
+        collected->clear();
+        collected->shrink_to_fit();
+    }
+}
+
+void type_index::name_table::build(std::vector<entry> &entries) {
+    std::sort(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+        return std::tie(a.name, a.declaration, a.offset) < std::tie(b.name, b.declaration, b.offset);
+    });
+    entries.erase(std::unique(entries.begin(), entries.end(), [](const entry &a, const entry &b) {
+        return a.name == b.name;
+    }), entries.end());
+
+    std::vector<char> name_chars{};
+    std::vector<uint32_t> name_begin{0};
+    std::vector<uint64_t> entry_offsets{};
+    for (const auto &e: entries) {
+        name_chars.insert(name_chars.end(), e.name.begin(), e.name.end());
+        name_begin.push_back(static_cast<uint32_t>(name_chars.size()));
+        entry_offsets.push_back(e.offset);
+    }
+    chars = flat_array{std::move(name_chars)};
+    begin = flat_array{std::move(name_begin)};
+    offsets = flat_array{std::move(entry_offsets)};
+    slots = flat_array{string_slots::build(static_cast<uint32_t>(entries.size()), [this](uint32_t e) {
+        return name(e);
+    })};
+}
+
+void type_index::name_table::save(index_cache::writer &out) const {
+    out.add(chars.span());
+    out.add(begin.span());
+    out.add(offsets.span());
+    out.add(slots.span());
+}
+
+void type_index::name_table::load(index_cache::reader &in) {
+    chars = flat_array{in.next<char>()};
+    begin = flat_array{in.next<uint32_t>()};
+    offsets = flat_array{in.next<uint64_t>()};
+    slots = flat_array{in.next<uint32_t>()};
+
+    // the lookups index with these without checking
+    auto n = offsets.size();
+    auto s = slots.span();
+    if (begin.size() != n + 1 || begin[0] != 0 || begin[n] != chars.size() ||
+        !std::is_sorted(begin.begin(), begin.end()) ||
+        s.empty() || (s.size() & (s.size() - 1)) != 0 ||
+        std::any_of(s.begin(), s.end(), [n](uint32_t e) {
+            return e != string_slots::empty && e >= n;
+        })) {
+        throw index_cache::format_error{"type index tables are inconsistent"};
+    }
+}
+
+auto type_index::name_table::name(uint32_t e) const -> std::string_view {
+    return {chars.span().data() + begin[e], begin[e + 1] - begin[e]};
+}
+
+auto type_index::name_table::find(std::string_view wanted) const -> std::optional<dwarf::section_offset> {
+    auto e = string_slots::find(slots.span(), wanted, [this](uint32_t e) {
+        return name(e);
+    });
+    if (!e) {
+        return std::nullopt;
+    }
+    return offsets[*e];
+}
+
+void type_index::save(index_cache::writer &out) const {
+    m_types.save(out);
+    m_globals.save(out);
+    out.add(m_declaration_offsets.span());
+    out.add(m_declaration_definitions.span());
+}
+
+void type_index::load(index_cache::reader &in) {
+    m_types.load(in);
+    m_globals.load(in);
+    m_declaration_offsets = flat_array{in.next<uint64_t>()};
+    m_declaration_definitions = flat_array{in.next<uint64_t>()};
+
+    if (m_declaration_definitions.size() != m_declaration_offsets.size() ||
+        !std::is_sorted(m_declaration_offsets.begin(), m_declaration_offsets.end())) {
+        throw index_cache::format_error{"type index tables are inconsistent"};
+    }
+}
+
+auto type_index::find(std::string_view qualified_name) const -> std::optional<dwarf::section_offset> {
+    return m_types.find(qualified_name);
+}
+
+auto type_index::definition_of(dwarf::section_offset declaration) const -> std::optional<dwarf::section_offset> {
+    auto it = std::lower_bound(m_declaration_offsets.begin(), m_declaration_offsets.end(), declaration);
+    if (it == m_declaration_offsets.end() || *it != declaration) {
+        return std::nullopt;
+    }
+    return m_declaration_definitions[it - m_declaration_offsets.begin()];
+}
+
+auto type_index::find_global(std::string_view qualified_name) const -> std::optional<dwarf::section_offset> {
+    return m_globals.find(qualified_name);
+}
+
+auto type_index::empty() const -> bool {
+    return m_types.offsets.empty() && m_globals.offsets.empty();
+}
@@ -0,0 +1,113 @@
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <cstddef>
+#include <stdexcept>
+#include "../include/watchpoint.h"
+
+namespace {
+    // DR7 condition bits
+    constexpr uint64_t rw_write = 0b01;
+    constexpr uint64_t rw_read_write = 0b11;
+
+    uint64_t dr7_len_bits(std::size_t len) {
+        switch (len) {
+            case 1:
+                return 0b00;
+            case 2:
+                return 0b01;
+            case 4:
+                return 0b11;
+            case 8:
+                return 0b10;
+            default:
+                throw std::invalid_argument{"watchpoint length must be 1, 2, 4 or 8 bytes"};
+        }
+    }
+}
+
+std::string to_string(watch_kind kind) {
+    switch (kind) {
+        case watch_kind::write:
+            return "watchpoint";
+        case watch_kind::read:
+            return "read watchpoint";
+        case watch_kind::access:
+            return "access watchpoint";
+    }
+    return "watchpoint";
+}
+
+hw_watchpoints::hw_watchpoints(pid_t pid) : m_pid{pid} {
+}
+
+unsigned hw_watchpoints::add(std::intptr_t addr, std::size_t len, watch_kind kind, uint64_t value) {
+    auto len_bits = dr7_len_bits(len);
+    if (addr % len != 0) {
+        throw std::invalid_argument{"watched address must be aligned to the watchpoint length"};
+    }
+
+    unsigned slot = 0;
+    while (slot < n_slots && m_slots[slot]) {
+        ++slot;
+    }
+    if (slot == n_slots) {
+        throw std::runtime_error{"all hardware watchpoint slots are in use"};
+    }
+
+    auto rw_bits = kind == watch_kind::write ? rw_write : rw_read_write;
+    auto dr7 = peek_debug_register(7);
+    dr7 &= ~(uint64_t{0b1111} << (16 + slot * 4));
+    dr7 |= (rw_bits | len_bits << 2) << (16 + slot * 4);
+    dr7 |= uint64_t{1} << (slot * 2); // local enable
+
+    // the address has to be in place before DR7 enables the slot
+    poke_debug_register(slot, addr);
+    poke_debug_register(7, dr7);
+
+    m_slots[slot] = watchpoint{addr, len, kind, value};
+    return slot;
+}
+
+void hw_watchpoints::remove(std::intptr_t addr) {
+    for (unsigned slot = 0; slot < n_slots; ++slot) {
+        if (m_slots[slot] && m_slots[slot]->addr == addr) {
+            auto dr7 = peek_debug_register(7);
+            dr7 &= ~(uint64_t{0b11} << (slot * 2));
+            dr7 &= ~(uint64_t{0b1111} << (16 + slot * 4));
+            poke_debug_register(7, dr7);
+            poke_debug_register(slot, 0);
+            m_slots[slot].reset();
+            return;
+        }
+    }
+    throw std::out_of_range{"no watchpoint at this address"};
+}
+
+std::optional<unsigned> hw_watchpoints::triggered() {
+    auto dr6 = peek_debug_register(6);
+    // the processor never clears DR6 itself
+    poke_debug_register(6, 0);
+
+    for (unsigned slot = 0; slot < n_slots; ++slot) {
+        if ((dr6 & (uint64_t{1} << slot)) && m_slots[slot]) {
+            return slot;
+        }
+    }
+    return std::nullopt;
+}
+
+watchpoint &hw_watchpoints::at(unsigned slot) {
+    return m_slots.at(slot).value();
+}
+
+void hw_watchpoints::poke_debug_register(unsigned index, uint64_t value) {
+    auto offset = offsetof(struct user, u_debugreg) + index * sizeof(uint64_t);
+    if (ptrace(PTRACE_POKEUSER, m_pid, offset, value) == -1) {
+        throw std::runtime_error{"cannot write debug register DR" + std::to_string(index)};
+    }
+}
+
+uint64_t hw_watchpoints::peek_debug_register(unsigned index) {
+    auto offset = offsetof(struct user, u_debugreg) + index * sizeof(uint64_t);
+    return ptrace(PTRACE_PEEKUSER, m_pid, offset, nullptr);
+}
@@ -0,0 +1,298 @@
+#include <array>
+#include "../include/x86_decoder.h"
+
+namespace {
+    // bitmap of the one-byte opcodes followed by a ModRM byte
+    constexpr std::array<uint16_t, 16> modrm_1byte{
+            0b0000'1111'0000'1111, // 00-0f
+            0b0000'1111'0000'1111, // 10-1f
+            0b0000'1111'0000'1111, // 20-2f
+            0b0000'1111'0000'1111, // 30-3f
+            0b0000'0000'0000'0000, // 40-4f
+            0b0000'0000'0000'0000, // 50-5f
+            0b0000'1010'0000'1100, // 60-6f: 62 63 69 6b
+            0b0000'0000'0000'0000, // 70-7f
+            0b1111'1111'1111'1111, // 80-8f
+            0b0000'0000'0000'0000, // 90-9f
+            0b0000'0000'0000'0000, // a0-af
+            0b0000'0000'0000'0000, // b0-bf
+            0b0000'0000'1111'0011, // c0-cf: c0 c1 c4-c7
+            0b1111'1111'0000'1111, // d0-df
+            0b0000'0000'0000'0000, // e0-ef
+            0b1100'0000'1100'0000, // f0-ff: f6 f7 fe ff
+    };
+
+    // bitmap of the 0F xx opcodes which are not followed by a ModRM byte
+    constexpr std::array<uint16_t, 16> no_modrm_0f{
+            0b0100'1011'1110'0000, // 00-0f: 05-09 0b 0e
+            0b0000'0000'0000'0000, // 10-1f
+            0b0000'0000'0000'0000, // 20-2f
+            0b0000'0000'1111'1111, // 30-3f: 30-37
+            0b0000'0000'0000'0000, // 40-4f
+            0b0000'0000'0000'0000, // 50-5f
+            0b0000'0000'0000'0000, // 60-6f
+            0b0000'0000'1000'0000, // 70-7f: 77
+            0b1111'1111'1111'1111, // 80-8f
+            0b0000'0000'0000'0000, // 90-9f
+            0b0000'0111'0000'0111, // a0-af: a0-a2 a8-aa
+            0b0000'0000'0000'0000, // b0-bf
+            0b1111'1111'0000'0000, // c0-cf: c8-cf
+            0b0000'0000'0000'0000, // d0-df
+            0b0000'0000'0000'0000, // e0-ef
+            0b0000'0000'0000'0000, // f0-ff
+    };
+
+    constexpr bool test(const std::array<uint16_t, 16> &bitmap, uint8_t op) {
+        return (bitmap[op >> 4] >> (op & 0xf)) & 1;
+    }
+
+    // 0F map opcodes with an imm8 after the ModRM byte, the same holds for
+    // their VEX/EVEX forms
+    constexpr bool imm8_0f(uint8_t op) {
+        return (op >= 0x70 && op <= 0x73) || op == 0xa4 || op == 0xac || op == 0xba ||
+               op == 0xc2 || (op >= 0xc4 && op <= 0xc6);
+    }
+
+    // opcodes which are invalid in 64-bit mode (c4/c5/62 are VEX/EVEX there)
+    constexpr bool invalid_1byte(uint8_t op) {
+        switch (op) {
+            case 0x06: case 0x07: case 0x0e: case 0x16: case 0x17: case 0x1e: case 0x1f:
+            case 0x27: case 0x2f: case 0x37: case 0x3f: case 0x60: case 0x61: case 0x82:
+            case 0x9a: case 0xce: case 0xd4: case 0xd5: case 0xd6: case 0xea:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    struct decoder {
+        const uint8_t *code;
+        std::size_t size;
+        std::size_t pos{};
+        x86_instruction insn{};
+
+        bool has(std::size_t n) const {
+            return pos + n <= size && pos + n <= x86_max_instruction_length;
+        }
+
+        // ModRM, SIB and displacement, returns the reg field of the ModRM
+        std::optional<unsigned> modrm() {
+            if (!has(1)) {
+                return std::nullopt;
+            }
+            auto m = code[pos++];
+            auto mod = m >> 6;
+            auto rm = m & 7;
+            std::size_t disp = 0;
+
+            if (mod != 3 && rm == 4) {
+                if (!has(1)) {
+                    return std::nullopt;
+                }
+                auto sib = code[pos++];
+                if (mod == 0 && (sib & 7) == 5) {
+                    disp = 4;
+                }
+            }
+            if (mod == 0 && rm == 5) {
+                // the base is RIP in 64-bit mode
+                insn.rip_disp_offset = pos;
+                disp = 4;
+            } else if (mod == 1) {
+                disp = 1;
+            } else if (mod == 2) {
+                disp = 4;
+            }
+
+            if (!has(disp)) {
+                return std::nullopt;
+            }
+            pos += disp;
+            return (m >> 3) & 7;
+        }
+
+        bool skip(std::size_t n) {
+            if (!has(n)) {
+                return false;
+            }
+            pos += n;
+            return true;
+        }
+
+        // VEX and EVEX: 0F map number, opcode, ModRM and an imm8 depending on the map
+        bool vex(unsigned map) {
+            if (map < 1 || map > 3 || !has(1)) {
+                return false;
+            }
+            auto op = code[pos++];
+            if (map == 1 && op == 0x77) { // vzeroupper/vzeroall
+                return true;
+            }
+            if (!modrm()) {
+                return false;
+            }
+            return (map == 3 || (map == 1 && imm8_0f(op))) ? skip(1) : true;
+        }
+
+        bool two_byte() {
+            if (!has(1)) {
+                return false;
+            }
+            auto op = code[pos++];
+            if (op == 0x38) {
+                return skip(1) && modrm().has_value();
+            }
+            if (op == 0x3a) {
+                return skip(1) && modrm().has_value() && skip(1);
+            }
+            if (op == 0x05 || op == 0x07 || op == 0x34 || op == 0x35 || op == 0x0b) {
+                // syscall/sysret/sysenter/sysexit/ud2
+                insn.flow = x86_flow::unsupported;
+            }
+            if (op >= 0x80 && op <= 0x8f) {
+                // near branches ignore the operand size prefix in 64-bit mode
+                insn.flow = x86_flow::relative_branch;
+                insn.rel_size = 4;
+                return skip(4);
+            }
+            if (test(no_modrm_0f, op)) {
+                return true;
+            }
+            if (op == 0x0f) { // 3DNow!, the opcode byte follows the operands
+                return modrm().has_value() && skip(1);
+            }
+            if (!modrm()) {
+                return false;
+            }
+            return imm8_0f(op) ? skip(1) : true;
+        }
+
+        bool decode() {
+            bool opsize = false;
+            bool addrsize = false;
+            bool rex_w = false;
+
+            // legacy prefixes
+            for (;;) {
+                if (!has(1)) {
+                    return false;
+                }
+                auto b = code[pos];
+                if (b == 0x66) {
+                    opsize = true;
+                } else if (b == 0x67) {
+                    addrsize = true;
+                } else if (b != 0xf0 && b != 0xf2 && b != 0xf3 && b != 0x2e && b != 0x36 &&
+                           b != 0x3e && b != 0x26 && b != 0x64 && b != 0x65) {
+                    break;
+                }
+                ++pos;
+            }
+
+            if ((code[pos] & 0xf0) == 0x40) {
+                rex_w = code[pos] & 8;
+                ++pos;
+                if (!has(1)) {
+                    return false;
+                }
+            }
+
+            auto op = code[pos++];
+            switch (op) {
+                case 0x0f:
+                    return two_byte();
+                case 0xc5:
+                    return skip(1) && vex(1);
+                case 0xc4:
+                    return has(2) && skip(2) && vex(code[pos - 2] & 0x1f);
+                case 0x62:
+                    return has(3) && skip(3) && vex(code[pos - 3] & 0x07);
+                default:
+                    break;
+            }
+            if (invalid_1byte(op)) {
+                return false;
+            }
+
+            std::optional<unsigned> reg{};
+            if (test(modrm_1byte, op)) {
+                reg = modrm();
+                if (!reg) {
+                    return false;
+                }
+            }
+
+            std::size_t imm_z = opsize ? 2 : 4;
+            switch (op) {
+                case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+                case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
+                case 0xe0: case 0xe1: case 0xe2: case 0xe3: case 0xeb:
+                    insn.flow = x86_flow::relative_branch;
+                    insn.rel_size = 1;
+                    return skip(1);
+                case 0xe9:
+                    insn.flow = x86_flow::relative_branch;
+                    insn.rel_size = 4;
+                    return skip(4);
+                case 0xe8:
+                    insn.flow = x86_flow::relative_call;
+                    insn.rel_size = 4;
+                    return skip(4);
+                case 0xc2: case 0xca:
+                    insn.flow = x86_flow::ret;
+                    return skip(2);
+                case 0xc3: case 0xcb: case 0xcf:
+                    insn.flow = x86_flow::ret;
+                    return true;
+                case 0xcc: case 0xf1:
+                    insn.flow = x86_flow::unsupported;
+                    return true;
+                case 0xcd:
+                    insn.flow = x86_flow::unsupported;
+                    return skip(1);
+                case 0xff:
+                    if (*reg == 2 || *reg == 3) {
+                        insn.flow = x86_flow::indirect_call;
+                    } else if (*reg == 4 || *reg == 5) {
+                        insn.flow = x86_flow::indirect_branch;
+                    }
+                    return true;
+                case 0x04: case 0x0c: case 0x14: case 0x1c: case 0x24: case 0x2c: case 0x34: case 0x3c:
+                case 0x6a: case 0x6b: case 0x80: case 0x83: case 0xa8: case 0xc0: case 0xc1: case 0xc6:
+                case 0xe4: case 0xe5: case 0xe6: case 0xe7:
+                case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
+                    return skip(1);
+                case 0x05: case 0x0d: case 0x15: case 0x1d: case 0x25: case 0x2d: case 0x35: case 0x3d:
+                case 0x68: case 0x69: case 0x81: case 0xa9:
+                    return skip(imm_z);
+                case 0xc7:
+                    if (*reg == 7) { // xbegin, the immediate is a fallback branch target
+                        insn.flow = x86_flow::unsupported;
+                    }
+                    return skip(imm_z);
+                case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+                    return skip(rex_w ? 8 : imm_z);
+                case 0xa0: case 0xa1: case 0xa2: case 0xa3:
+                    return skip(addrsize ? 4 : 8);
+                case 0xc8:
+                    return skip(3);
+                case 0xf6: case 0xf7:
+                    if (*reg < 2) { // test r/m, imm
+                        return skip(op == 0xf6 ? 1 : imm_z);
+                    }
+                    return true;
+                default:
+                    return true;
+            }
+        }
+    };
+}
+
+auto decode_x86_instruction(const uint8_t *code, std::size_t size) -> std::optional<x86_instruction> {
+    decoder d{code, size};
+    if (!d.decode()) {
+        return std::nullopt;
+    }
+    d.insn.length = d.pos;
+    return d.insn;
+}